@@ -0,0 +1,156 @@
+/*
+ * Synthetic X client for benchmarking fastcompmgr (s. run-bench.sh).
+ * Creates a cascade of stacked opaque and ARGB windows, where no window is
+ * fully occluded, and scripts a storm of moves, resizes, scroll damage or
+ * map/unmap requests on them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+typedef enum {
+  SCENARIO_MOVE,
+  SCENARIO_RESIZE,
+  SCENARIO_SCROLL,
+  SCENARIO_MAPSTORM,
+} scenario;
+
+typedef struct {
+  Window id;
+  GC gc;
+  int argb;
+} bench_win;
+
+static const char *scenario_names[] = { "move", "resize", "scroll", "mapstorm", NULL };
+
+static void
+usage(const char *name) {
+  fprintf(stderr,
+    "usage: %s [-n windows] [-f frames] [-i interval-us] move|resize|scroll|mapstorm\n",
+    name);
+  exit(1);
+}
+
+static unsigned long
+win_color(int i, int argb) {
+  unsigned long rgb = ((i * 0x3b) & 0xff) << 16 | ((i * 0x71) & 0xff) << 8 | 0x80;
+  // premultiplied, half transparent
+  return argb ? 0x80000000 | ((rgb >> 1) & 0x7f7f7f) : rgb;
+}
+
+static void
+create_win(Display *dpy, XVisualInfo *argb_vi, bench_win *w, int i,
+           int x, int y, int width, int height) {
+  XSetWindowAttributes attr = { 0 };
+  unsigned long mask = CWBackPixel | CWBorderPixel;
+  Window root = DefaultRootWindow(dpy);
+
+  w->argb = argb_vi && (i & 1);
+  if (w->argb) {
+    attr.colormap = XCreateColormap(dpy, root, argb_vi->visual, AllocNone);
+    mask |= CWColormap;
+    w->id = XCreateWindow(dpy, root, x, y, width, height, 0, argb_vi->depth,
+                          InputOutput, argb_vi->visual, mask, &attr);
+  } else {
+    w->id = XCreateWindow(dpy, root, x, y, width, height, 0, CopyFromParent,
+                          InputOutput, CopyFromParent, mask, &attr);
+  }
+  w->gc = XCreateGC(dpy, w->id, 0, NULL);
+  XSetForeground(dpy, w->gc, win_color(i, w->argb));
+  XMapWindow(dpy, w->id);
+  XFillRectangle(dpy, w->id, w->gc, 0, 0, width, height);
+}
+
+int
+main(int argc, char **argv) {
+  int nwins = 16;
+  int frames = 600;
+  useconds_t interval = 4000;
+  int width, height, sw, sh;
+  scenario sc = SCENARIO_MOVE;
+  XVisualInfo argb_vi;
+  bench_win *wins;
+  Display *dpy;
+  int i, f, o;
+
+  while ((o = getopt(argc, argv, "n:f:i:")) != -1) {
+    switch (o) {
+      case 'n': nwins = atoi(optarg); break;
+      case 'f': frames = atoi(optarg); break;
+      case 'i': interval = atoi(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || nwins < 1) usage(argv[0]);
+  for (i = 0; scenario_names[i]; i++) {
+    if (strcmp(argv[optind], scenario_names[i]) == 0) break;
+  }
+  if (!scenario_names[i]) usage(argv[0]);
+  sc = i;
+
+  dpy = XOpenDisplay(NULL);
+  if (!dpy) {
+    fprintf(stderr, "Can't open display\n");
+    return 1;
+  }
+  sw = DisplayWidth(dpy, DefaultScreen(dpy));
+  sh = DisplayHeight(dpy, DefaultScreen(dpy));
+  width = sw / 2;
+  height = sh / 2;
+
+  wins = calloc(nwins, sizeof(bench_win));
+  if (!wins) return 1;
+  if (!XMatchVisualInfo(dpy, DefaultScreen(dpy), 32, TrueColor, &argb_vi)) {
+    fprintf(stderr, "No ARGB visual, creating opaque windows only\n");
+  }
+
+  // a cascade: every window is offset, so none is fully occluded.
+  for (i = 0; i < nwins; i++) {
+    create_win(dpy, argb_vi.visual ? &argb_vi : NULL, &wins[i], i,
+               (i * 37) % (sw - width), (i * 23) % (sh - height), width, height);
+  }
+  XSync(dpy, False);
+  // let the compositor settle
+  usleep(200000);
+
+  for (f = 0; f < frames; f++) {
+    bench_win *top = &wins[nwins - 1];
+    switch (sc) {
+      case SCENARIO_MOVE:
+        XMoveWindow(dpy, top->id, (f * 7) % (sw - width), (f * 3) % (sh - height));
+        break;
+      case SCENARIO_RESIZE:
+        XResizeWindow(dpy, top->id, width / 2 + (f * 5) % (width / 2),
+                      height / 2 + (f * 3) % (height / 2));
+        break;
+      case SCENARIO_SCROLL:
+        // like kinetic scrolling: shift up and paint the exposed band
+        XCopyArea(dpy, top->id, top->id, top->gc, 0, 16, width, height - 16, 0, 0);
+        XSetForeground(dpy, top->gc, win_color(f, top->argb));
+        XFillRectangle(dpy, top->id, top->gc, 0, height - 16, width, 16);
+        break;
+      case SCENARIO_MAPSTORM: {
+        bench_win *w = &wins[f % nwins];
+        XUnmapWindow(dpy, w->id);
+        XMapWindow(dpy, w->id);
+        XFillRectangle(dpy, w->id, w->gc, 0, 0, width, height);
+        break;
+      }
+    }
+    XSync(dpy, False);
+    if (interval) usleep(interval);
+  }
+
+  for (i = 0; i < nwins; i++) {
+    XFreeGC(dpy, wins[i].gc);
+    XDestroyWindow(dpy, wins[i].id);
+  }
+  free(wins);
+  XCloseDisplay(dpy);
+  return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Microbenchmark of the shadow kernel: the double precision convolution
+ * fastcompmgr used before (reference below) against cm-gauss.c, for the
+ * startup presum of the corner and for the shadows of small windows, which
+ * are still rasterized on the CPU. Also counts the bytes differing between
+ * the two.
+ *
+ * Usage: fcm-gauss-bench [-n iterations] [radius...]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../cm-gauss.h"
+
+time_t _program_start_secs; // for cm-util.h
+
+typedef struct {
+  int size;
+  double *data;
+} conv;
+
+static double
+gaussian(double r, double x, double y) {
+  return ((1 / (sqrt(2 * M_PI * r))) *
+      exp((- (x * x + y * y)) / (2 * r * r)));
+}
+
+static conv *
+make_gaussian_map(double r) {
+  conv *c;
+  int size = ((int) ceil((r * 3)) + 1) & ~1;
+  int center = size / 2;
+  double t = 0;
+
+  c = malloc(sizeof(conv) + size * size * sizeof(double));
+  c->size = size;
+  c->data = (double *) (c + 1);
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      double g = gaussian(r, (double) (x - center), (double) (y - center));
+      t += g;
+      c->data[y * size + x] = g;
+    }
+  }
+  for (int i = 0; i < size * size; i++) c->data[i] /= t;
+  return c;
+}
+
+static unsigned char
+sum_gaussian(conv *map, double opacity, int x, int y, int width, int height) {
+  int g_size = map->size;
+  int center = g_size / 2;
+  int fx_start, fx_end, fy_start, fy_end;
+  double v = 0;
+
+  fx_start = center - x;
+  if (fx_start < 0) fx_start = 0;
+  fx_end = width + center - x;
+  if (fx_end > g_size) fx_end = g_size;
+  fy_start = center - y;
+  if (fy_start < 0) fy_start = 0;
+  fy_end = height + center - y;
+  if (fy_end > g_size) fy_end = g_size;
+
+  for (int fy = fy_start; fy < fy_end; fy++) {
+    for (int fx = fx_start; fx < fx_end; fx++) {
+      v += map->data[fy * g_size + fx];
+    }
+  }
+  if (v > 1) v = 1;
+  return ((unsigned char) (v * opacity * 255.0));
+}
+
+/// The corner (with the window's size) of the shadow, as make_shadow needs it.
+static void
+corner_ref(conv *map, double opacity, int width, int height, int n,
+           unsigned char *out) {
+  int center = map->size / 2;
+  for (int y = 0; y < n; y++) {
+    for (int x = 0; x < n; x++) {
+      out[y * n + x] = sum_gaussian(map, opacity, x - center, y - center,
+                                    width, height);
+    }
+  }
+}
+
+static void
+corner_fixed(GaussMap *map, double opacity, int width, int height, int n,
+             unsigned char *out) {
+  int center = map->size / 2;
+  gauss_fill(map, opacity, width, height,
+             -center, -center, n - center, n - center, out, n);
+}
+
+static double
+now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void
+bench(double r, const char *what, int width, int height, double opacity,
+      int iterations) {
+  conv *ref = make_gaussian_map(r);
+  GaussMap *fixed = gauss_map_new(r);
+  int g = ref->size;
+  // presum: the whole corner, else as much as a small window shows
+  int n = (width == 2 * g) ? g + 1 : (g < (width + g + 1) / 2 ? g : (width + g + 1) / 2);
+  unsigned char *a = malloc(n * n), *b = malloc(n * n);
+  int diff = 0, maxdiff = 0;
+  double t0, t_ref, t_fixed;
+
+  t0 = now_us();
+  for (int i = 0; i < iterations; i++) corner_ref(ref, opacity, width, height, n, a);
+  t_ref = (now_us() - t0) / iterations;
+
+  t0 = now_us();
+  for (int i = 0; i < iterations; i++) corner_fixed(fixed, opacity, width, height, n, b);
+  t_fixed = (now_us() - t0) / iterations;
+
+  for (int i = 0; i < n * n; i++) {
+    int d = abs(a[i] - b[i]);
+    if (d) diff++;
+    if (d > maxdiff) maxdiff = d;
+  }
+  printf("%6.1f %-8s %5dx%-5d %12.1f %12.2f %8.1fx %6d %4d\n",
+         r, what, width, height, t_ref, t_fixed, t_ref / t_fixed, diff, maxdiff);
+
+  free(a);
+  free(b);
+  free(ref);
+  gauss_map_free(fixed);
+}
+
+int
+main(int argc, char **argv) {
+  static const double default_radii[] = { 3, 6, 12, 24, 48 };
+  static const int sizes[] = { 4, 16, 64 };
+  int iterations = 20;
+  int o;
+
+  while ((o = getopt(argc, argv, "n:")) != -1) {
+    switch (o) {
+    case 'n': iterations = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-n iterations] [radius...]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (iterations < 1) iterations = 1;
+
+  printf("%6s %-8s %11s %12s %12s %9s %6s %4s\n", "radius", "what", "size",
+         "double-us", "fixed-us", "speedup", "diff", "max");
+  int nradii = (optind < argc) ? argc - optind : 5;
+  for (int i = 0; i < nradii; i++) {
+    double r = (optind < argc) ? atof(argv[optind + i]) : default_radii[i];
+    int g = ((int) ceil((r * 3)) + 1) & ~1;
+
+    bench(r, "presum", 2 * g, 2 * g, 1, iterations);
+    for (unsigned k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+      if (sizes[k] >= g) continue; // larger windows use the presummed tiles
+      bench(r, "window", sizes[k], sizes[k], 0.75, iterations);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,308 @@
+/*
+ * Replays a trace of fastcompmgr --record (s. cm-trace.h) on another X server,
+ * e.g. a fresh Xvfb (s. run-bench.sh): rebuilds the recorded window tree and
+ * drives a compositor through the same sequence of creates, maps, configures,
+ * destroys and damage, so paint counts and CPU time can be compared across
+ * builds. Property, shape, RandR and focus events are not reproduced.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include "../cm-trace.h"
+
+typedef struct {
+  uint32_t rec;  // the recorded window, 0 for a free slot
+  Window id;     // ... and ours, None once destroyed
+  GC gc;
+  int argb;
+} replay_win;
+
+// open addressing, recorded ids are never reused within a trace
+static replay_win *wins;
+static unsigned wins_size;
+static unsigned wins_used;
+
+static XVisualInfo argb_vi;
+static int x_errors;
+
+static void
+usage(const char *name) {
+  fprintf(stderr, "usage: %s [-s speed] trace\n"
+    "  speed: factor of the recorded pace, 0 replays without delays (default 1)\n",
+    name);
+  exit(1);
+}
+
+static int
+error_handler(Display *dpy, XErrorEvent *ev) {
+  // e.g. configures of windows, which the recording saw already destroyed
+  x_errors++;
+  return 0;
+}
+
+static replay_win *
+win_slot(uint32_t rec) {
+  unsigned h = (rec * 2654435761u) & (wins_size - 1);
+  while (wins[h].rec && wins[h].rec != rec) h = (h + 1) & (wins_size - 1);
+  return &wins[h];
+}
+
+static replay_win *
+find_win(uint32_t rec) {
+  replay_win *w = win_slot(rec);
+  return w->rec && w->id ? w : NULL;
+}
+
+static void
+grow_wins(void) {
+  replay_win *old = wins;
+  unsigned old_size = wins_size;
+
+  wins_size = old_size ? old_size * 2 : 256;
+  wins = calloc(wins_size, sizeof(replay_win));
+  if (!wins) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  for (unsigned i = 0; i < old_size; i++) {
+    if (old[i].rec) *win_slot(old[i].rec) = old[i];
+  }
+  free(old);
+}
+
+static unsigned long
+win_color(uint32_t n, int argb) {
+  unsigned long rgb = ((n * 0x3b) & 0xff) << 16 | ((n * 0x71) & 0xff) << 8 | 0x80;
+  // premultiplied, half transparent
+  return argb ? 0x80000000 | ((rgb >> 1) & 0x7f7f7f) : rgb;
+}
+
+static replay_win *
+create_win(Display *dpy, const TraceRecord *r) {
+  XSetWindowAttributes attr = { 0 };
+  unsigned long mask = CWBackPixel | CWBorderPixel | CWOverrideRedirect;
+  Window root = DefaultRootWindow(dpy);
+  int width = r->width ? r->width : 1;
+  int height = r->height ? r->height : 1;
+  replay_win *w;
+
+  if ((wins_used + 1) * 2 > wins_size) grow_wins();
+  w = win_slot(r->window);
+  if (!w->rec) wins_used++;
+  else if (w->id) return w;
+  w->rec = r->window;
+  w->argb = (r->flags & TRACE_ARGB) && argb_vi.visual;
+  attr.override_redirect = (r->flags & TRACE_OVERRIDE_REDIRECT) != 0;
+  if (w->argb) {
+    attr.colormap = XCreateColormap(dpy, root, argb_vi.visual, AllocNone);
+    mask |= CWColormap;
+    w->id = XCreateWindow(dpy, root, r->x, r->y, width, height, r->border_width,
+                          argb_vi.depth, InputOutput, argb_vi.visual, mask, &attr);
+  } else {
+    w->id = XCreateWindow(dpy, root, r->x, r->y, width, height, r->border_width,
+                          CopyFromParent, InputOutput, CopyFromParent, mask, &attr);
+  }
+  w->gc = XCreateGC(dpy, w->id, 0, NULL);
+  return w;
+}
+
+static void
+destroy_win(Display *dpy, replay_win *w) {
+  XFreeGC(dpy, w->gc);
+  XDestroyWindow(dpy, w->id);
+  w->id = None;
+}
+
+static void
+configure_win(Display *dpy, const TraceRecord *r) {
+  replay_win *w = find_win(r->window);
+  XWindowChanges wc = {
+    .x = r->x, .y = r->y,
+    .width = r->width ? r->width : 1, .height = r->height ? r->height : 1,
+    .border_width = r->border_width,
+  };
+  unsigned mask = CWX | CWY | CWWidth | CWHeight | CWBorderWidth | CWStackMode;
+
+  if (!w) return;
+  if (r->aux) {
+    replay_win *above = find_win(r->aux);
+    if (!above) {
+      mask &= ~CWStackMode;
+    } else {
+      wc.sibling = above->id;
+      wc.stack_mode = Above;
+      mask |= CWSibling;
+    }
+  } else {
+    // no sibling below: the bottom of the stack
+    wc.stack_mode = Below;
+  }
+  XConfigureWindow(dpy, w->id, mask, &wc);
+}
+
+static void
+damage_win(Display *dpy, const TraceRecord *r, uint32_t n) {
+  replay_win *w = find_win(r->window);
+  if (!w) return;
+  XSetForeground(dpy, w->gc, win_color(n, w->argb));
+  XFillRectangle(dpy, w->id, w->gc, r->x, r->y, r->width, r->height);
+}
+
+/// Returns 0, if the record is not reproduced.
+static int
+replay(Display *dpy, const TraceHeader *h, const TraceRecord *r, uint32_t n) {
+  replay_win *w;
+
+  switch (r->type) {
+    case TRACE_INITIAL:
+      w = create_win(dpy, r);
+      if (r->flags & TRACE_MAPPED) {
+        XMapWindow(dpy, w->id);
+        XSetForeground(dpy, w->gc, win_color(n, w->argb));
+        XFillRectangle(dpy, w->id, w->gc, 0, 0, r->width, r->height);
+      }
+      return 1;
+    case CreateNotify:
+      create_win(dpy, r);
+      return 1;
+    case ConfigureNotify:
+      if (r->window == h->root) return 0;
+      configure_win(dpy, r);
+      return 1;
+    case DestroyNotify:
+      if ((w = find_win(r->window))) destroy_win(dpy, w);
+      return 1;
+    case MapNotify:
+      if ((w = find_win(r->window))) XMapWindow(dpy, w->id);
+      return 1;
+    case UnmapNotify:
+      if ((w = find_win(r->window))) XUnmapWindow(dpy, w->id);
+      return 1;
+    case ReparentNotify:
+      // the compositor only sees the children of the root
+      if (r->aux == h->root) {
+        create_win(dpy, r);
+      } else if ((w = find_win(r->window))) {
+        destroy_win(dpy, w);
+      }
+      return 1;
+    case CirculateNotify:
+      if (!(w = find_win(r->window))) return 1;
+      if (r->flags & TRACE_PLACE_BOTTOM) XLowerWindow(dpy, w->id);
+      else XRaiseWindow(dpy, w->id);
+      return 1;
+    case TRACE_DAMAGE:
+      damage_win(dpy, r, n);
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static long
+now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+int
+main(int argc, char **argv) {
+  double speed = 1.0;
+  TraceHeader h;
+  TraceRecord r;
+  Window *initial = NULL;
+  int num_initial = 0;
+  uint32_t n = 0, skipped = 0;
+  long start, due = 0;
+  Display *dpy;
+  FILE *f;
+  int o;
+
+  while ((o = getopt(argc, argv, "s:")) != -1) {
+    switch (o) {
+      case 's': speed = atof(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || speed < 0) usage(argv[0]);
+
+  f = fopen(argv[optind], "rb");
+  if (!f) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (fread(&h, sizeof(h), 1, f) != 1
+      || memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) != 0) {
+    fprintf(stderr, "%s: not a fastcompmgr trace\n", argv[optind]);
+    return 1;
+  }
+
+  dpy = XOpenDisplay(NULL);
+  if (!dpy) {
+    fprintf(stderr, "Can't open display\n");
+    return 1;
+  }
+  XSetErrorHandler(error_handler);
+  if (DisplayWidth(dpy, DefaultScreen(dpy)) != h.root_width
+      || DisplayHeight(dpy, DefaultScreen(dpy)) != h.root_height) {
+    fprintf(stderr, "warning: the trace was recorded on a %ux%u screen\n",
+            h.root_width, h.root_height);
+  }
+  if (!XMatchVisualInfo(dpy, DefaultScreen(dpy), 32, TrueColor, &argb_vi)) {
+    fprintf(stderr, "No ARGB visual, creating opaque windows only\n");
+  }
+  grow_wins();
+
+  start = now_us();
+  while (fread(&r, sizeof(r), 1, f) == 1) {
+    if (r.type == TRACE_INITIAL) {
+      Window *tmp = realloc(initial, (num_initial + 1) * sizeof(Window));
+      if (!tmp) return 1;
+      initial = tmp;
+      if (!replay(dpy, &h, &r, n++)) skipped++;
+      initial[num_initial++] = find_win(r.window)->id;
+      continue;
+    }
+    if (initial) {
+      // topmost first, as recorded
+      XRestackWindows(dpy, initial, num_initial);
+      free(initial);
+      initial = NULL;
+      XSync(dpy, False);
+      start = now_us();
+    }
+    if (speed > 0) {
+      due += r.time_us / speed;
+      long wait = start + due - now_us();
+      if (wait > 0) {
+        XFlush(dpy);
+        usleep(wait);
+      }
+    }
+    if (!replay(dpy, &h, &r, n++)) skipped++;
+  }
+  if (initial) {
+    XRestackWindows(dpy, initial, num_initial);
+    free(initial);
+  }
+  XSync(dpy, False);
+  fprintf(stderr, "replayed %u records in %.3f s, %u skipped, %d X errors\n",
+          n, (now_us() - start) / 1e6, skipped, x_errors);
+
+  for (unsigned i = 0; i < wins_size; i++) {
+    if (wins[i].rec && wins[i].id) destroy_win(dpy, &wins[i]);
+  }
+  free(wins);
+  XCloseDisplay(dpy);
+  fclose(f);
+  return 0;
+}
@@ -0,0 +1,94 @@
+#!/bin/sh
+# Headless benchmark of fastcompmgr: for every scenario, start a fresh Xvfb
+# and fastcompmgr, let bench/fcm-bench-client script the window storm and
+# report compositor CPU time, frames, X requests per frame and the
+# event-to-paint latency from fastcompmgr's --stats.
+# The scenario "replay" instead replays BENCH_TRACE, recorded with
+# fastcompmgr --record, by bench/fcm-replay.
+#
+# Environment: FCM_ARGS (default "-o 0.4 -r 12 -c -C"), BENCH_WINDOWS (16),
+# BENCH_FRAMES (600), BENCH_SCENARIOS (move resize scroll mapstorm),
+# BENCH_DISPLAY (:99), BENCH_SCREEN (1920x1080x24), BENCH_TRACE,
+# BENCH_REPLAY_SPEED (1, 0 replays without delays).
+
+set -e
+cd "$(dirname "$0")/.."
+
+FCM_ARGS=${FCM_ARGS-"-o 0.4 -r 12 -c -C"}
+BENCH_WINDOWS=${BENCH_WINDOWS:-16}
+BENCH_FRAMES=${BENCH_FRAMES:-600}
+BENCH_SCENARIOS=${BENCH_SCENARIOS:-"move resize scroll mapstorm"}
+BENCH_DISPLAY=${BENCH_DISPLAY:-:99}
+BENCH_SCREEN=${BENCH_SCREEN:-1920x1080x24}
+BENCH_REPLAY_SPEED=${BENCH_REPLAY_SPEED:-1}
+
+command -v Xvfb >/dev/null || { echo "Xvfb not found" >&2; exit 1; }
+case " $BENCH_SCENARIOS " in
+  *" replay "*) [ -r "$BENCH_TRACE" ] ||
+    { echo "replay needs BENCH_TRACE, a trace of fastcompmgr --record" >&2; exit 1; } ;;
+esac
+
+tmp=$(mktemp -d)
+xvfb_pid=
+fcm_pid=
+cleanup() {
+  [ -n "$fcm_pid" ] && kill "$fcm_pid" 2>/dev/null
+  [ -n "$xvfb_pid" ] && kill "$xvfb_pid" 2>/dev/null
+  rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+clk_tck=$(getconf CLK_TCK)
+# user + system time of a process in milliseconds
+cpu_ms() {
+  awk -v hz="$clk_tck" '{ sub(/.*\) /, ""); print int(($12 + $13) * 1000 / hz) }' \
+    "/proc/$1/stat"
+}
+
+printf '%-9s %8s %8s %10s %9s %9s\n' \
+  scenario cpu-ms frames req/frame p50-ms p99-ms
+for scenario in $BENCH_SCENARIOS; do
+  Xvfb "$BENCH_DISPLAY" -screen 0 "$BENCH_SCREEN" -nolisten tcp \
+    +extension Composite +extension DAMAGE +extension RENDER \
+    >"$tmp/xvfb.log" 2>&1 &
+  xvfb_pid=$!
+  export DISPLAY="$BENCH_DISPLAY"
+  i=0
+  # wait for Xvfb to accept connections
+  until ./bench/fcm-bench-client -n 1 -f 0 move 2>/dev/null; do
+    i=$((i + 1))
+    [ $i -gt 50 ] && { echo "Xvfb did not start" >&2; cat "$tmp/xvfb.log" >&2; exit 1; }
+    sleep 0.1
+  done
+
+  # shellcheck disable=SC2086
+  ./fastcompmgr $FCM_ARGS --stats 2>"$tmp/stats" &
+  fcm_pid=$!
+  sleep 0.5
+  cpu0=$(cpu_ms $fcm_pid)
+
+  if [ "$scenario" = replay ]; then
+    ./bench/fcm-replay -s "$BENCH_REPLAY_SPEED" "$BENCH_TRACE" 2>>"$tmp/replay.log"
+  else
+    ./bench/fcm-bench-client -n "$BENCH_WINDOWS" -f "$BENCH_FRAMES" "$scenario"
+  fi
+
+  cpu1=$(cpu_ms $fcm_pid)
+  kill -TERM $fcm_pid
+  wait $fcm_pid || true
+  fcm_pid=
+  kill $xvfb_pid
+  wait $xvfb_pid 2>/dev/null || true
+  xvfb_pid=
+
+  awk -v scenario="$scenario" -v cpu=$((cpu1 - cpu0)) '
+    /^frames:/ { frames = $2 }
+    /^X requests:/ { rpf = $NF }
+    /^event-to-paint latency:/ { p50 = $4; p99 = $7 }
+    END { printf "%-9s %8d %8d %10s %9s %9s\n", scenario, cpu, frames, rpf, p50, p99 }
+  ' "$tmp/stats"
+done
+
+# e.g. the number of records replayed and skipped
+[ -s "$tmp/replay.log" ] && cat "$tmp/replay.log" >&2
+exit 0
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cm-ctl.h"
+#include "cm-util.h"
+
+static int _listen_fd = -1;
+static int _clients[CTL_MAX_FDS - 1];
+static int _deadlines[CTL_MAX_FDS - 1]; // in milliseconds, s. CTL_CLIENT_TIMEOUT_MS
+static int _num_clients = 0;
+static CtlReport _report;
+static CtlReset _reset;
+static char _path[sizeof(((struct sockaddr_un *)0)->sun_path)]; // to unlink at exit
+
+static void
+_cleanup(void) {
+  if (_path[0]) unlink(_path);
+}
+
+/// Listen on path, in the abstract namespace, if it starts with '@'.
+bool ctl_init(const char *path, CtlReport report, CtlReset reset) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  size_t n = strlen(path);
+  socklen_t len;
+  struct stat st;
+  int fd;
+
+  if (n < 2 && path[0] == '@') n = 0;
+  if (n == 0 || n >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "fastcompmgr: invalid control socket path '%s'\n", path);
+    return false;
+  }
+  memcpy(addr.sun_path, path, n);
+  if (path[0] == '@') {
+    addr.sun_path[0] = '\0';
+    len = offsetof(struct sockaddr_un, sun_path) + n;
+  } else {
+    len = offsetof(struct sockaddr_un, sun_path) + n + 1;
+    // left over by a crashed instance
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, len) < 0 || listen(fd, 4) < 0) {
+    fprintf(stderr, "fastcompmgr: control socket %s: %s\n", path, strerror(errno));
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  if (path[0] != '@') {
+    memcpy(_path, path, n + 1);
+    atexit(_cleanup);
+  }
+  _listen_fd = fd;
+  _report = report;
+  _reset = reset;
+  return true;
+}
+
+static void
+_close_client(int fd) {
+  for (int i = 0; i < _num_clients; i++) {
+    if (_clients[i] == fd) {
+      _num_clients--;
+      _clients[i] = _clients[_num_clients];
+      _deadlines[i] = _deadlines[_num_clients];
+      break;
+    }
+  }
+  close(fd);
+}
+
+/// Answer cmd to the client. The answer is small enough for the socket's
+/// buffer, we never block on a client.
+static void
+_answer(int fd, char *cmd) {
+  char *answer = NULL;
+  size_t size = 0;
+  FILE *f;
+
+  cmd[strcspn(cmd, " \t\r\n")] = '\0';
+  f = open_memstream(&answer, &size);
+  if (f) {
+    if (!cmd[0] || !strcmp(cmd, "stats")) {
+      _report(f);
+    } else if (!strcmp(cmd, "reset")) {
+      _reset();
+      fprintf(f, "ok\n");
+    } else {
+      fprintf(f, "unknown command '%s', try stats or reset\n", cmd);
+    }
+    fclose(f);
+    for (size_t done = 0; done < size; ) {
+      ssize_t w = send(fd, answer + done, size - done, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (w <= 0) break;
+      done += w;
+    }
+    free(answer);
+  }
+  _close_client(fd);
+}
+
+/// Read the client's command and answer it.
+static void
+_serve(int fd) {
+  char cmd[64];
+  ssize_t r;
+
+  r = read(fd, cmd, sizeof(cmd) - 1);
+  if (r < 0 && (errno == EAGAIN || errno == EINTR)) return;
+  if (r < 0) r = 0;
+  cmd[r] = '\0';
+  _answer(fd, cmd);
+}
+
+/// Milliseconds until the earliest client is due (s. CTL_CLIENT_TIMEOUT_MS),
+/// -1 if there is none.
+int ctl_timeout(void) {
+  int now, ms = -1;
+  if (likely(!_num_clients)) return -1;
+  now = get_time_in_milliseconds();
+  for (int i = 0; i < _num_clients; i++) {
+    int left = _deadlines[i] - now;
+    if (left < 0) left = 0;
+    if (ms < 0 || left < ms) ms = left;
+  }
+  return ms;
+}
+
+/// Fill fds (room for CTL_MAX_FDS) with the sockets to poll for input. Returns
+/// their number, 0 without a control socket. Clients past their deadline are
+/// answered first, as if they had sent nothing.
+int ctl_pollfds(struct pollfd *fds) {
+  int n = 0;
+  if (likely(_listen_fd < 0)) return 0;
+  if (unlikely(_num_clients)) {
+    int now = get_time_in_milliseconds();
+    for (int i = _num_clients - 1; i >= 0; i--) {
+      char none[1] = "";
+      if (now >= _deadlines[i]) _answer(_clients[i], none);
+    }
+  }
+  fds[n].fd = _listen_fd;
+  fds[n++].events = POLLIN;
+  for (int i = 0; i < _num_clients; i++) {
+    fds[n].fd = _clients[i];
+    fds[n++].events = POLLIN;
+  }
+  return n;
+}
+
+/// Process the sockets filled in by ctl_pollfds, after poll.
+void ctl_handle(const struct pollfd *fds, int n) {
+  for (int i = 1; i < n; i++) {
+    if (fds[i].revents) _serve(fds[i].fd);
+  }
+  if (n && (fds[0].revents & POLLIN)) {
+    int fd = accept4(_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+    if (_num_clients == CTL_MAX_FDS - 1) {
+      close(fd);
+      return;
+    }
+    _deadlines[_num_clients] = get_time_in_milliseconds() + CTL_CLIENT_TIMEOUT_MS;
+    _clients[_num_clients++] = fd;
+  }
+}
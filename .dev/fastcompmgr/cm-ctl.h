@@ -0,0 +1,30 @@
+#pragma once
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * An optional Unix stream socket to query fastcompmgr at runtime, e.g. with
+ * fastcompmgr-ctl. A client sends one command line and receives the answer,
+ * then the connection is closed. Commands:
+ *   stats  the counters of cm-stats.h (also, if the client sends nothing
+ *          within CTL_CLIENT_TIMEOUT_MS)
+ *   reset  zero the counters
+ */
+
+// the listening socket plus at most CTL_MAX_FDS - 1 clients
+#define CTL_MAX_FDS 5
+
+// a client, which neither sends a command nor shuts down, is answered then
+#define CTL_CLIENT_TIMEOUT_MS 1000
+
+// Writes the current counters to f.
+typedef void (*CtlReport)(FILE *f);
+// Zeroes them.
+typedef void (*CtlReset)(void);
+
+bool ctl_init(const char *path, CtlReport report, CtlReset reset);
+int ctl_timeout(void);
+int ctl_pollfds(struct pollfd *fds);
+void ctl_handle(const struct pollfd *fds, int n);
@@ -0,0 +1,196 @@
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "cm-gauss.h"
+#include "cm-util.h"
+
+// out[i] = (cols[i] * row) >> (2 * GAUSS_SHIFT), for i in [0, n)
+typedef void (*_RowFunc)(const uint32_t *cols, uint32_t row,
+                         unsigned char *out, int n);
+
+static void
+_row_scalar(const uint32_t *cols, uint32_t row, unsigned char *out, int n) {
+  for (int i = 0; i < n; i++) {
+    out[i] = ((uint64_t)cols[i] * row) >> (2 * GAUSS_SHIFT);
+  }
+}
+
+#ifdef __SSE2__
+static void
+_row_sse2(const uint32_t *cols, uint32_t row, unsigned char *out, int n) {
+  const __m128i r = _mm_set1_epi32(row);
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i c = _mm_loadu_si128((const __m128i *)(cols + i));
+    // 32 x 32 -> 64 bit products of the even and the odd lanes
+    __m128i even = _mm_srli_epi64(_mm_mul_epu32(c, r), 2 * GAUSS_SHIFT);
+    __m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(c, 32), r),
+                                 2 * GAUSS_SHIFT);
+    __m128i v = _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+    v = _mm_packs_epi32(v, v);
+    v = _mm_packus_epi16(v, v);
+    uint32_t bytes = _mm_cvtsi128_si32(v);
+    memcpy(out + i, &bytes, 4);
+  }
+  _row_scalar(cols + i, row, out + i, n - i);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void
+_row_avx2(const uint32_t *cols, uint32_t row, unsigned char *out, int n) {
+  const __m256i r = _mm256_set1_epi32(row);
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i c = _mm256_loadu_si256((const __m256i *)(cols + i));
+    __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(c, r), 2 * GAUSS_SHIFT);
+    __m256i odd = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(c, 32), r),
+                                    2 * GAUSS_SHIFT);
+    __m256i v = _mm256_or_si256(even, _mm256_slli_epi64(odd, 32));
+    // packing works per 128 bit lane: the low 4 bytes of each are the result
+    v = _mm256_packs_epi32(v, v);
+    v = _mm256_packus_epi16(v, v);
+    uint32_t lo = _mm_cvtsi128_si32(_mm256_castsi256_si128(v));
+    uint32_t hi = _mm_cvtsi128_si32(_mm256_extracti128_si256(v, 1));
+    memcpy(out + i, &lo, 4);
+    memcpy(out + i + 4, &hi, 4);
+  }
+  _row_scalar(cols + i, row, out + i, n - i);
+}
+#endif
+
+static _RowFunc _row = NULL;
+
+static void
+_select_row_func(void) {
+  _row = _row_scalar;
+#ifdef __SSE2__
+  _row = _row_sse2;
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) _row = _row_avx2;
+#endif
+}
+
+/// Same size and (normalized) values as the former double precision map.
+GaussMap *
+gauss_map_new(double r) {
+  int size = ((int) ceil((r * 3)) + 1) & ~1;
+  int center = size / 2;
+  double *g;
+  double t = 0, sum = 0;
+  GaussMap *map;
+  int i;
+
+  if (!_row) _select_row_func();
+
+  map = malloc(sizeof(GaussMap) + (size + 1) * sizeof(uint32_t));
+  g = malloc((size ? size : 1) * sizeof(double));
+  if (unlikely(!map || !g)) {
+    free(map);
+    free(g);
+    return NULL;
+  }
+  map->size = size;
+  map->presum = (uint32_t *)(map + 1);
+
+  for (i = 0; i < size; i++) {
+    g[i] = exp(-(double)(i - center) * (i - center) / (2 * r * r));
+    t += g[i];
+  }
+  map->presum[0] = 0;
+  for (i = 0; i < size; i++) {
+    sum += g[i];
+    map->presum[i + 1] = (uint32_t)(sum / t * (1 << GAUSS_SHIFT) + 0.5);
+  }
+  free(g);
+  return map;
+}
+
+void
+gauss_map_free(GaussMap *map) {
+  free(map);
+}
+
+/// The sum of the 1D kernel over [0, width), centered at x.
+static inline uint32_t
+_span(const GaussMap *map, int x, int width) {
+  int center = map->size / 2;
+  int start = center - x;
+  int end = width + center - x;
+
+  if (start < 0) start = 0;
+  if (end > map->size) end = map->size;
+  if (end <= start) return 0;
+  return map->presum[end] - map->presum[start];
+}
+
+/// The fixed point factor (s. _row) of column x. It is biased down by one, like
+/// the former double sums were by rounding errors: even the complete kernel
+/// gives 254, not 255, for full opacity.
+static inline uint32_t
+_col_factor(const GaussMap *map, int x, int width) {
+  uint32_t span = _span(map, x, width);
+  return span ? span - 1 : 0;
+}
+
+/// The fixed point factor (s. _row) of row y.
+static inline uint32_t
+_row_factor(const GaussMap *map, uint64_t opacity, int y, int height) {
+  return ((uint64_t)_span(map, y, height) * opacity) >> GAUSS_SHIFT;
+}
+
+/// opacity * 255 in fixed point
+static inline uint64_t
+_opacity(double opacity) {
+  return (uint64_t)(normalize_d(opacity) * 255 * (1 << GAUSS_SHIFT) + 0.5);
+}
+
+/// The shadow value at (x, y) of a width x height window: the sum of the kernel
+/// centered there over the window, times opacity.
+unsigned char
+gauss_sum(const GaussMap *map, double opacity,
+          int x, int y, int width, int height) {
+  uint32_t row = _row_factor(map, _opacity(opacity), y, height);
+  return ((uint64_t)_col_factor(map, x, width) * row) >> (2 * GAUSS_SHIFT);
+}
+
+/// data[(y - y0) * stride + x - x0] = gauss_sum(map, opacity, x, y, width, height)
+/// for x in [x0, x1), y in [y0, y1).
+void
+gauss_fill(const GaussMap *map, double opacity, int width, int height,
+           int x0, int y0, int x1, int y1, unsigned char *data, int stride) {
+  uint64_t op = _opacity(opacity);
+  uint32_t stack_cols[256];
+  uint32_t *cols = stack_cols;
+  int n = x1 - x0;
+
+  if (n <= 0 || y1 <= y0) return;
+  if (n > 256) {
+    cols = malloc(n * sizeof(uint32_t));
+    if (unlikely(!cols)) {
+      for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+          data[(y - y0) * stride + x - x0] = gauss_sum(map, opacity, x, y, width, height);
+        }
+      }
+      return;
+    }
+  }
+  for (int x = x0; x < x1; x++) cols[x - x0] = _col_factor(map, x, width);
+
+  for (int y = y0; y < y1; y++) {
+    _row(cols, _row_factor(map, op, y, height), data + (y - y0) * stride, n);
+  }
+  if (cols != stack_cols) free(cols);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * The shadow's gaussian kernel is the outer product of a 1D gaussian with
+ * itself. So its sum over a rectangle (s. gauss_sum) is the product of two 1D
+ * sums, each the difference of two prefix sums. These are kept in fixed point,
+ * a shadow pixel costs one integer multiplication instead of a convolution.
+ */
+
+// fixed point shift of GaussMap.presum
+#define GAUSS_SHIFT 24
+
+typedef struct {
+  int size;         // width and height of the kernel, even
+  uint32_t *presum; // presum[i]: sum of the 1D kernel over [0, i), size + 1 of them
+} GaussMap;
+
+GaussMap *gauss_map_new(double r);
+void gauss_map_free(GaussMap *map);
+unsigned char gauss_sum(const GaussMap *map, double opacity,
+                        int x, int y, int width, int height);
+void gauss_fill(const GaussMap *map, double opacity, int width, int height,
+                int x0, int y0, int x1, int y1, unsigned char *data, int stride);
@@ -0,0 +1,160 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <X11/extensions/Xrandr.h>
+
+#include "cm-monitor.h"
+#include "cm-global.h"
+#include "cm-root.h"
+#include "cm-util.h"
+
+// Assumed, if RandR does not tell us better.
+#define DEFAULT_REFRESH_HZ 60.0
+
+Monitor *monitors = NULL;
+int num_monitors = 0;
+int randr_event = 0;
+
+static double
+_mode_refresh_hz(XRRScreenResources *res, RRMode mode) {
+  for (int i = 0; i < res->nmode; i++) {
+    XRRModeInfo *m = &res->modes[i];
+    if (m->id != mode) continue;
+
+    double vtotal = m->vTotal;
+    if (m->modeFlags & RR_DoubleScan) vtotal *= 2;
+    if (m->modeFlags & RR_Interlace) vtotal /= 2;
+    if (!m->hTotal || !vtotal) return DEFAULT_REFRESH_HZ;
+    return m->dotClock / (m->hTotal * vtotal);
+  }
+  return DEFAULT_REFRESH_HZ;
+}
+
+static void
+_monitors_set_root() {
+  Monitor *m = realloc(monitors, sizeof(Monitor));
+  if (!m) return;
+  monitors = m;
+  monitors[0].rect.x = monitors[0].rect.y = 0;
+  monitors[0].rect.width = root_width;
+  monitors[0].rect.height = root_height;
+  monitors[0].refresh_hz = DEFAULT_REFRESH_HZ;
+  num_monitors = 1;
+}
+
+/// (Re-)create the regions of all monitors and damage them completely.
+static void
+_monitors_init_regions() {
+  long now = get_time_in_microseconds();
+  for (int i = 0; i < num_monitors; i++) {
+    Monitor *m = &monitors[i];
+    CompBox box = { .x1 = m->rect.x, .y1 = m->rect.y,
+                    .x2 = m->rect.x + m->rect.width,
+                    .y2 = m->rect.y + m->rect.height };
+    m->damage = (CompRegion){0};
+    comp_region_set_box(&m->damage, &box);
+    m->damaged = true;
+    m->damage_time = now;
+    m->paint_cost_us = 0;
+  }
+}
+
+static void
+_monitors_free_regions() {
+  for (int i = 0; i < num_monitors; i++) {
+    comp_region_free(&monitors[i].damage);
+  }
+}
+
+static void
+_monitors_read() {
+  XRRScreenResources *res;
+  Monitor *m;
+  int n = 0;
+
+  if (!randr_event || !(res = XRRGetScreenResourcesCurrent(g_dpy, root))) {
+    _monitors_set_root();
+    return;
+  }
+  m = realloc(monitors, (res->ncrtc ? res->ncrtc : 1) * sizeof(Monitor));
+  if (!m) {
+    XRRFreeScreenResources(res);
+    return;
+  }
+  monitors = m;
+
+  for (int i = 0; i < res->ncrtc; i++) {
+    XRRCrtcInfo *crtc = XRRGetCrtcInfo(g_dpy, res, res->crtcs[i]);
+    if (!crtc) continue;
+    if (crtc->mode != None && crtc->width && crtc->height) {
+      monitors[n].rect.x = crtc->x;
+      monitors[n].rect.y = crtc->y;
+      monitors[n].rect.width = crtc->width;
+      monitors[n].rect.height = crtc->height;
+      monitors[n].refresh_hz = _mode_refresh_hz(res, crtc->mode);
+      n++;
+    }
+    XRRFreeCrtcInfo(crtc);
+  }
+  XRRFreeScreenResources(res);
+
+  // Too many to address by a bitmask: treat the root as one.
+  if (n == 0 || n > MAX_MONITORS) {
+    _monitors_set_root();
+    return;
+  }
+  num_monitors = n;
+}
+
+/// (Re-)read the geometry and refresh rate of the active CRTCs. All of them
+/// are damaged afterwards.
+void monitors_update() {
+  _monitors_free_regions();
+  _monitors_read();
+  _monitors_init_regions();
+}
+
+bool monitors_init() {
+  int error_base;
+  if (XRRQueryExtension(g_dpy, &randr_event, &error_base)) {
+    XRRSelectInput(g_dpy, root, RRScreenChangeNotifyMask);
+  } else {
+    randr_event = 0;
+  }
+  monitors_update();
+  return num_monitors > 0;
+}
+
+/// Returns true, if ev was a RandR event.
+bool monitors_handle_event(XEvent *ev) {
+  if (!randr_event || ev->type != randr_event + RRScreenChangeNotify) {
+    return false;
+  }
+  XRRUpdateConfiguration(ev);
+  monitors_update();
+  return true;
+}
+
+/// Returns the bitmask of the monitors intersecting r, all of them, if r is NULL.
+unsigned monitors_mask(const XRectangle *r) {
+  unsigned mask = 0;
+  if (!r) return (num_monitors >= 32) ? ~0u : (1u << num_monitors) - 1;
+  for (int i = 0; i < num_monitors; i++) {
+    XRectangle *m = &monitors[i].rect;
+    if (r->x < m->x + m->width && m->x < r->x + r->width &&
+        r->y < m->y + m->height && m->y < r->y + r->height) {
+      mask |= 1u << i;
+    }
+  }
+  return mask;
+}
+
+/// The display rate of the fastest monitor.
+double monitors_max_refresh_hz() {
+  double hz = 0;
+  for (int i = 0; i < num_monitors; i++) {
+    if (monitors[i].refresh_hz > hz) hz = monitors[i].refresh_hz;
+  }
+  return hz > 0 ? hz : DEFAULT_REFRESH_HZ;
+}
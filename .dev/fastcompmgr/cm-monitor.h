@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <X11/Xlib.h>
+
+#include "comp_rect.h"
+
+// Monitors are addressed by bitmasks, so there are at most 32 of them.
+#define MAX_MONITORS 32
+
+typedef struct {
+  XRectangle rect;
+  double refresh_hz;
+  CompRegion damage;     // accumulated since its last frame, within rect
+  bool damaged;
+  long damage_time;      // when it became damaged, in microseconds
+  double paint_cost_us;  // moving average of the durations of its frames
+} Monitor;
+
+// The active RandR CRTCs. Without RandR, a single monitor covering the root.
+extern Monitor *monitors;
+extern int num_monitors;
+// RandR's event base, 0 if unavailable
+extern int randr_event;
+
+bool monitors_init();
+void monitors_update();
+bool monitors_handle_event(XEvent *ev);
+double monitors_max_refresh_hz();
+unsigned monitors_mask(const XRectangle *r);
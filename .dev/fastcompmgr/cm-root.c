@@ -11,12 +11,14 @@ Picture root_picture;
 Picture root_buffer;
 int root_width;
 int root_height;
+Pixmap root_tile_pixmap = None;
 
 const char *root_background_props[] = {
   "_XROOTPMAP_ID",
   "_XSETROOT_ID",
   0
 };
+static Atom _background_atoms[sizeof(root_background_props) / sizeof(root_background_props[0])];
 
 
 static inline int
@@ -86,36 +88,38 @@ bool root_init(){
   root_picture = XRenderCreatePicture(g_dpy, root,
     XRenderFindVisualFormat(g_dpy, DefaultVisual(g_dpy, g_screen)),
     CPSubwindowMode, &pa);
+
+  for (int p = 0; root_background_props[p]; p++) {
+    _background_atoms[p] = XInternAtom(g_dpy, root_background_props[p], False);
+  }
   return true;
 }
 
-/// Create the root background picture. First check, if the root window already
-/// has a valid corresponding pixmap. If so, do not overwrite it, such that e.g.
-/// openbox's root background image is preserved. Create the picture using the
-/// same depth, otherwise we're flooded with errors like
-/// "error 143 (BadPicture) request 139 minor 8 serial 78698". If no valid
-/// background pixmap is found, we create one ourselves using DefaultVisual()
-/// and set a fixed solid background color.
-Picture root_create_tile() {
-  Picture picture;
+/// Returns true, if atom is one of root_background_props.
+bool root_is_background_atom(Atom atom) {
+  for (int p = 0; root_background_props[p]; p++) {
+    if (atom == _background_atoms[p]) return true;
+  }
+  return false;
+}
+
+/// Returns the first valid pixmap named by root_background_props and its
+/// depth, None if there is none.
+Pixmap root_background_pixmap(unsigned *depth) {
   Atom actual_type;
   Pixmap pixmap;
   int actual_format;
   unsigned long nitems;
   unsigned long bytes_after;
   unsigned char *prop;
-  unsigned pict_depth = 0;
-  bool fill;
   int p;
   int res;
-  const char* valid_pix_str;
-
-  pixmap = None;
 
+  *depth = 0;
   for (p=0; root_background_props[p]; p++) {
+    pixmap = None;
     prop = NULL;
-    res = XGetWindowProperty(g_dpy, root,
-          XInternAtom(g_dpy, root_background_props[p], False),
+    res = XGetWindowProperty(g_dpy, root, _background_atoms[p],
           0, 4, False, AnyPropertyType, &actual_type,
           &actual_format, &nitems, &bytes_after, &prop);
     if (res != Success || prop == NULL ){
@@ -126,13 +130,30 @@ Picture root_create_tile() {
       memcpy(&pixmap, prop, 4);
     }
     XFree(prop);
-    pict_depth = _get_valid_pixmap_depth(pixmap);
-    if(pict_depth){
-      break;
-    } else {
-      pixmap = None;
+    *depth = _get_valid_pixmap_depth(pixmap);
+    if(*depth){
+      return pixmap;
     }
   }
+  return None;
+}
+
+/// Create the root background picture. First check, if the root window already
+/// has a valid corresponding pixmap. If so, do not overwrite it, such that e.g.
+/// openbox's root background image is preserved. Create the picture using the
+/// same depth, otherwise we're flooded with errors like
+/// "error 143 (BadPicture) request 139 minor 8 serial 78698". If no valid
+/// background pixmap is found, we create one ourselves using DefaultVisual()
+/// and set a fixed solid background color.
+Picture root_create_tile() {
+  Picture picture;
+  Pixmap pixmap;
+  unsigned pict_depth = 0;
+  bool fill;
+  const char* valid_pix_str;
+
+  pixmap = root_background_pixmap(&pict_depth);
+  root_tile_pixmap = pixmap;
 
   if(pixmap == None){
     valid_pix_str = "invalid";
@@ -151,6 +172,8 @@ Picture root_create_tile() {
     c.alpha = 0xffff;
     XRenderFillRectangle(
       g_dpy, PictOpSrc, picture, &c, 0, 0, 1, 1);
+    // the picture keeps it alive
+    XFreePixmap(g_dpy, pixmap);
   }
   return picture;
 }
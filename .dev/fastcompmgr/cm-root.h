@@ -11,7 +11,11 @@ extern Picture root_buffer;
 extern int root_width;
 extern int root_height;
 extern const char *root_background_props[];
+// The background pixmap root_create_tile found, None for its own fill.
+extern Pixmap root_tile_pixmap;
 
 
 bool root_init();
 Picture root_create_tile();
+bool root_is_background_atom(Atom atom);
+Pixmap root_background_pixmap(unsigned *depth);
@@ -0,0 +1,123 @@
+#include <string.h>
+
+#include <X11/X.h>
+#include <X11/extensions/Xdamage.h>
+
+#include "cm-stats.h"
+
+Stats g_stats;
+int g_stats_event = 0;
+
+static const char *
+_event_name(int type, int damage_event) {
+  static char buf[32];
+
+  switch (type) {
+  case 0: return "(no event)";
+  case FocusIn: return "FocusIn";
+  case FocusOut: return "FocusOut";
+  case Expose: return "Expose";
+  case CreateNotify: return "CreateNotify";
+  case DestroyNotify: return "DestroyNotify";
+  case UnmapNotify: return "UnmapNotify";
+  case MapNotify: return "MapNotify";
+  case ReparentNotify: return "ReparentNotify";
+  case ConfigureNotify: return "ConfigureNotify";
+  case CirculateNotify: return "CirculateNotify";
+  case PropertyNotify: return "PropertyNotify";
+  case SelectionClear: return "SelectionClear";
+  default:
+    if (type == damage_event + XDamageNotify) return "DamageNotify";
+    snprintf(buf, sizeof(buf), "Event %d", type);
+    return buf;
+  }
+}
+
+void stats_add_latency(long usec) {
+  long i = usec / STATS_LATENCY_US_PER_BUCKET;
+  if (i < 0) i = 0;
+  if (i >= STATS_LATENCY_BUCKETS) i = STATS_LATENCY_BUCKETS - 1;
+  g_stats.latency[i]++;
+}
+
+void stats_add_paint(long usec) {
+  int i = 0;
+  while (i < STATS_PAINT_BUCKETS - 1 && usec >= (64L << i)) i++;
+  g_stats.paint_hist[i]++;
+}
+
+/// Returns the latency in milliseconds below which the fraction q of the frames lies.
+static double _latency_quantile(double q) {
+  unsigned long total = 0, sum = 0;
+  int i;
+
+  for (i = 0; i < STATS_LATENCY_BUCKETS; i++) total += g_stats.latency[i];
+  if (!total) return 0.0;
+  for (i = 0; i < STATS_LATENCY_BUCKETS - 1; i++) {
+    sum += g_stats.latency[i];
+    if (sum >= q * total) break;
+  }
+  return (i + 1) * STATS_LATENCY_US_PER_BUCKET / 1000.0;
+}
+
+/// Print per event type counters: how often an event was received, how many
+/// window lookups it caused and how many table entries these had to visit.
+void stats_print(FILE *f, int damage_event) {
+  fprintf(f, "%-18s %12s %12s %10s\n", "event", "count", "win-lookups", "steps/lookup");
+  for (int i = 0; i < STATS_NUM_EVENTS; i++) {
+    if (!g_stats.events[i] && !g_stats.win_lookups[i]) continue;
+    fprintf(f, "%-18s %12lu %12lu %10.2f\n", _event_name(i, damage_event),
+            g_stats.events[i], g_stats.win_lookups[i],
+            g_stats.win_lookups[i] ?
+              (double)g_stats.win_lookup_steps[i] / g_stats.win_lookups[i] : 0.0);
+  }
+  fprintf(f, "shadows: %lu tiled, %lu rasterized, %lu bytes of cached tiles\n",
+          g_stats.shadow_builds_tiled, g_stats.shadow_builds_cpu,
+          g_stats.shadow_tile_bytes);
+  fprintf(f, "occlusion: %lu of %lu tested windows culled (%.1f%%)\n",
+          g_stats.occlusion_culled, g_stats.occlusion_tests,
+          g_stats.occlusion_tests ?
+            100.0 * g_stats.occlusion_culled / g_stats.occlusion_tests : 0.0);
+  fprintf(f, "unredirected fullscreen: %lu times\n", g_stats.unredirects);
+  fprintf(f, "damage: %lu areas reported, %lu added after merging\n",
+          g_stats.damage_areas, g_stats.damage_areas_added);
+  fprintf(f, "frames: %lu completed, %lu paints deferred while in flight\n",
+          g_stats.frames, g_stats.frames_deferred);
+  fprintf(f, "server wait per frame: %.2f ms\n",
+          g_stats.frames ? g_stats.server_wait_us / 1000.0 / g_stats.frames : 0.0);
+  fprintf(f, "paint time:");
+  for (int i = 0; i < STATS_PAINT_BUCKETS; i++) {
+    if (i < STATS_PAINT_BUCKETS - 1) {
+      fprintf(f, " <%ldus %lu", 64L << i, g_stats.paint_hist[i]);
+    } else {
+      fprintf(f, " more %lu", g_stats.paint_hist[i]);
+    }
+  }
+  fprintf(f, "\n");
+  fprintf(f, "windows: %lu, %lu mapped\n", g_stats.windows, g_stats.windows_mapped);
+  fprintf(f, "X requests: %lu, per frame: %.1f\n", g_stats.requests,
+          g_stats.frames ? (double)g_stats.requests / g_stats.frames : 0.0);
+  fprintf(f, "configure throttle: %lu intervals, avg %.1f ms "
+          "(refresh %.1f Hz, paint cost %.2f ms)\n",
+          g_stats.configure_paints,
+          g_stats.configure_paints ?
+            (double)g_stats.configure_interval_ms / g_stats.configure_paints : 0.0,
+          g_stats.refresh_hz, g_stats.paint_cost_us / 1000.0);
+  fprintf(f, "event-to-paint latency: p50 %.1f ms, p99 %.1f ms\n",
+          _latency_quantile(0.5), _latency_quantile(0.99));
+  fflush(f);
+}
+
+/// Zero the counters. The gauges (shadow_tile_bytes, paint_cost_us, ...) keep
+/// their values, requests must be up to date.
+void stats_reset(void) {
+  Stats gauges = g_stats;
+
+  memset(&g_stats, 0, sizeof(g_stats));
+  g_stats.shadow_tile_bytes = gauges.shadow_tile_bytes;
+  g_stats.paint_cost_us = gauges.paint_cost_us;
+  g_stats.refresh_hz = gauges.refresh_hz;
+  g_stats.windows = gauges.windows;
+  g_stats.windows_mapped = gauges.windows_mapped;
+  g_stats.requests_base = gauges.requests_base + gauges.requests;
+}
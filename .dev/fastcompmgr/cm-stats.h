@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdio.h>
+
+// X event types are < 128 (bit 7 is the send_event flag).
+#define STATS_NUM_EVENTS 128
+
+// event-to-paint latency histogram: 100us per bucket, the last collects the rest
+#define STATS_LATENCY_BUCKETS 1001
+#define STATS_LATENCY_US_PER_BUCKET 100
+
+// paint_all durations: bucket i counts those below 64us << i, the last the rest
+#define STATS_PAINT_BUCKETS 12
+
+typedef struct {
+  unsigned long events[STATS_NUM_EVENTS];
+  unsigned long win_lookups[STATS_NUM_EVENTS];
+  unsigned long win_lookup_steps[STATS_NUM_EVENTS];
+  unsigned long shadow_builds_tiled; // assembled on the server from cached tiles
+  unsigned long shadow_builds_cpu;   // rasterized by make_shadow and uploaded
+  unsigned long shadow_tile_bytes;   // server memory of the cached shadow tiles
+  unsigned long occlusion_tests;     // windows tested against the occlusion region
+  unsigned long occlusion_culled;    // ... and found to be fully covered
+  unsigned long unredirects;         // fullscreen windows bypassing compositing
+  unsigned long damage_areas;        // reported by DamageNotify
+  unsigned long damage_areas_added;  // ... and left after merging them per window
+  unsigned long frames;              // frames completed by the server
+  unsigned long frames_deferred;     // paints postponed, as a frame was in flight
+  unsigned long server_wait_us;      // sum of the times from submitting to completing frames
+  unsigned long paint_hist[STATS_PAINT_BUCKETS]; // client side time of paint_all
+  unsigned long requests;            // X requests sent, updated before printing
+  unsigned long requests_base;       // ... before the last stats_reset
+  unsigned long configure_paints;    // paints which started a configure throttle
+  unsigned long configure_interval_ms; // ... and the sum of their intervals
+  double paint_cost_us;              // moving average of frame durations
+  double refresh_hz;                 // of the fastest monitor
+  unsigned long windows;             // managed windows, updated before printing
+  unsigned long windows_mapped;      // ... of which are viewable
+  unsigned long latency[STATS_LATENCY_BUCKETS]; // first damage to frame done
+} Stats;
+
+extern Stats g_stats;
+// Type of the event currently being processed, 0 outside of event processing.
+extern int g_stats_event;
+
+void stats_add_latency(long usec);
+void stats_add_paint(long usec);
+void stats_print(FILE *f, int damage_event);
+void stats_reset(void);
@@ -0,0 +1,153 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/randr.h>
+#include <X11/extensions/shape.h>
+
+#include "cm-trace.h"
+#include "cm-monitor.h"
+#include "cm-util.h"
+
+static FILE *_file = NULL;
+static long _last_us;
+static int _damage_event;
+static int _shape_event;
+
+static inline int16_t
+_pos(int v) {
+  return v < INT16_MIN ? INT16_MIN : v > INT16_MAX ? INT16_MAX : v;
+}
+
+static inline uint16_t
+_size(int v) {
+  return v < 0 ? 0 : v > UINT16_MAX ? UINT16_MAX : v;
+}
+
+static void
+_write(TraceRecord *r) {
+  long now = get_time_in_microseconds();
+  long delta = now - _last_us;
+
+  r->time_us = delta > UINT32_MAX ? UINT32_MAX : delta;
+  _last_us = now;
+  // buffered by stdio, flushed on exit
+  fwrite(r, sizeof(*r), 1, _file);
+}
+
+/// Start recording to path, truncating it.
+bool trace_open(const char *path, Window root, int width, int height,
+                int damage_event, int shape_event) {
+  TraceHeader h = { .root = root, .root_width = _size(width),
+                    .root_height = _size(height) };
+
+  _file = fopen(path, "wb");
+  if (!_file) {
+    perror("fastcompmgr: failed to open the trace file");
+    return false;
+  }
+  memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+  fwrite(&h, sizeof(h), 1, _file);
+  _damage_event = damage_event;
+  _shape_event = shape_event;
+  _last_us = get_time_in_microseconds();
+  return true;
+}
+
+/// Record a window present at startup. Call them topmost first.
+void trace_window(Window id, const XWindowAttributes *a) {
+  if (!_file) return;
+
+  TraceRecord r = {
+    .window = id, .type = TRACE_INITIAL,
+    .x = _pos(a->x), .y = _pos(a->y),
+    .width = _size(a->width), .height = _size(a->height),
+    .border_width = _size(a->border_width),
+  };
+  if (a->override_redirect) r.flags |= TRACE_OVERRIDE_REDIRECT;
+  if (a->map_state == IsViewable) r.flags |= TRACE_MAPPED;
+  if (a->depth == 32) r.flags |= TRACE_ARGB;
+  _write(&r);
+}
+
+/// Record ev, once it was handled. added are the attributes of the window ev
+/// added (Create- or ReparentNotify), if any.
+void trace_event(const XEvent *ev, const XWindowAttributes *added) {
+  if (!_file) return;
+
+  TraceRecord r = {
+    .serial = ev->xany.serial, .window = ev->xany.window,
+    .type = ev->type & 0x7f,
+  };
+  if (added && added->depth == 32) r.flags |= TRACE_ARGB;
+  switch (ev->type) {
+    case CreateNotify: {
+      const XCreateWindowEvent *e = &ev->xcreatewindow;
+      r.window = e->window;
+      r.x = _pos(e->x); r.y = _pos(e->y);
+      r.width = _size(e->width); r.height = _size(e->height);
+      r.border_width = _size(e->border_width);
+      if (e->override_redirect) r.flags |= TRACE_OVERRIDE_REDIRECT;
+      break;
+    }
+    case ConfigureNotify: {
+      const XConfigureEvent *e = &ev->xconfigure;
+      r.window = e->window;
+      r.aux = e->above;
+      r.x = _pos(e->x); r.y = _pos(e->y);
+      r.width = _size(e->width); r.height = _size(e->height);
+      r.border_width = _size(e->border_width);
+      if (e->override_redirect) r.flags |= TRACE_OVERRIDE_REDIRECT;
+      break;
+    }
+    case DestroyNotify:
+      r.window = ev->xdestroywindow.window;
+      break;
+    case MapNotify:
+      r.window = ev->xmap.window;
+      if (ev->xmap.override_redirect) r.flags |= TRACE_OVERRIDE_REDIRECT;
+      break;
+    case UnmapNotify:
+      r.window = ev->xunmap.window;
+      break;
+    case ReparentNotify: {
+      const XReparentEvent *e = &ev->xreparent;
+      r.window = e->window;
+      r.aux = e->parent;
+      r.x = _pos(e->x); r.y = _pos(e->y);
+      if (added) {
+        r.width = _size(added->width); r.height = _size(added->height);
+        r.border_width = _size(added->border_width);
+      }
+      if (e->override_redirect) r.flags |= TRACE_OVERRIDE_REDIRECT;
+      break;
+    }
+    case CirculateNotify:
+      r.window = ev->xcirculate.window;
+      if (ev->xcirculate.place == PlaceOnBottom) r.flags |= TRACE_PLACE_BOTTOM;
+      break;
+    case Expose:
+      r.x = _pos(ev->xexpose.x); r.y = _pos(ev->xexpose.y);
+      r.width = _size(ev->xexpose.width); r.height = _size(ev->xexpose.height);
+      break;
+    case PropertyNotify:
+      r.aux = ev->xproperty.atom;
+      break;
+    default:
+      if (ev->type == _damage_event + XDamageNotify) {
+        const XDamageNotifyEvent *de = (const XDamageNotifyEvent *)ev;
+        r.type = TRACE_DAMAGE;
+        r.window = de->drawable;
+        r.x = _pos(de->area.x); r.y = _pos(de->area.y);
+        r.width = de->area.width; r.height = de->area.height;
+      } else if (_shape_event && ev->type == _shape_event + ShapeNotify) {
+        r.type = TRACE_SHAPE;
+      } else if (randr_event && ev->type >= randr_event
+                 && ev->type < randr_event + RRNumberEvents) {
+        r.type = TRACE_RANDR;
+      }
+      break;
+  }
+  _write(&r);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <X11/Xlib.h>
+
+/*
+ * Recording of the events fastcompmgr processes (--record), to drive it
+ * through the same sequence again with bench/fcm-replay. A trace is a
+ * TraceHeader followed by TraceRecords, both in host byte order. It starts
+ * with one TRACE_INITIAL record per window present at startup, topmost first.
+ */
+
+#define TRACE_MAGIC "FCMTRC1"
+
+// TraceRecord.type: core event types as they are, extension events mapped to
+// these, as their numbers depend on the server.
+#define TRACE_DAMAGE 100
+#define TRACE_SHAPE 101
+#define TRACE_RANDR 102
+#define TRACE_INITIAL 103
+
+// TraceRecord.flags
+#define TRACE_OVERRIDE_REDIRECT 1
+#define TRACE_MAPPED 2        // TRACE_INITIAL: the window is viewable
+#define TRACE_ARGB 4          // TRACE_INITIAL, CreateNotify, ReparentNotify:
+                              // 32 bit visual
+#define TRACE_PLACE_BOTTOM 8  // CirculateNotify: PlaceOnBottom
+
+typedef struct {
+  char magic[8];      // TRACE_MAGIC
+  uint32_t root;      // the recorded root window
+  uint16_t root_width;
+  uint16_t root_height;
+} TraceHeader;
+
+typedef struct {
+  uint32_t time_us;   // since the previous record
+  uint32_t serial;    // low 32 bits of the event's serial
+  uint32_t window;
+  uint32_t aux;       // above (ConfigureNotify), parent (ReparentNotify),
+                      // atom (PropertyNotify)
+  int16_t x, y;       // geometry or the exposed / damaged area, the size of
+                      // a window reparented to the root is that of add_win
+  uint16_t width, height;
+  uint16_t border_width;
+  uint8_t type;
+  uint8_t flags;
+} TraceRecord;
+
+bool trace_open(const char *path, Window root, int width, int height,
+                int damage_event, int shape_event);
+void trace_window(Window id, const XWindowAttributes *a);
+void trace_event(const XEvent *ev, const XWindowAttributes *added);
@@ -2,3 +2,11 @@
 #include "cm-util.h"
 
 time_t _program_start_secs = 0;
+
+/// Start the clock of get_time_in_milliseconds, which thus fits an int for
+/// weeks of uptime.
+void time_init(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  _program_start_secs = ts.tv_sec;
+}
@@ -1,10 +1,12 @@
 #pragma once
 
-#include <sys/time.h>
 #include <string.h>
+#include <time.h>
 
 extern time_t _program_start_secs;
 
+void time_init(void);
+
 #define likely(x)       __builtin_expect(!!(x), 1)
 #define unlikely(x)     __builtin_expect(!!(x), 0)
 
@@ -16,11 +18,19 @@ extern time_t _program_start_secs;
 #define WRITE_ONCE(x, val) \
 do { ACCESS_ONCE(x) = (val); } while (0)
 
+// Monotonic: steps of the wall clock must not stall, nor rush, any timer.
 static inline int
 get_time_in_milliseconds() {
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
-  return (tv.tv_sec-_program_start_secs) * 1000 + tv.tv_usec / 1000;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec-_program_start_secs) * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline long
+get_time_in_microseconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec-_program_start_secs) * 1000000L + ts.tv_nsec / 1000;
 }
 
 // normalize double to range 0-1
@@ -1,5 +1,6 @@
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <X11/Xatom.h>
 
@@ -7,10 +8,18 @@
 #include "cm-root.h"
 #include "cm-window.h"
 #include "cm-global.h"
+#include "cm-stats.h"
 #include "cm-util.h"
 
 
 win *list;
+static win *_list_tail = NULL; // the bottommost window
+
+// XID -> win lookup table for find_win. Windows are chained through
+// win->hash_next. Only windows not (yet) destroyed are in the table.
+static win **_win_table = NULL;
+static unsigned _win_table_size = 0; // always a power of two
+static unsigned _win_table_count = 0;
 
 typedef struct _AtomArr {
   Atom *atoms;
@@ -69,10 +78,87 @@ static bool win_has_atom(Window window, Atom atom){
 }
 
 
+static inline unsigned _win_hash(Window id) {
+  // XIDs of one client only differ in their low bits, so mix them up.
+  return (unsigned)((id * 2654435761u) >> 8) & (_win_table_size - 1);
+}
+
+
+static void _win_table_resize(unsigned size) {
+  win **old = _win_table;
+  unsigned old_size = _win_table_size;
+
+  _win_table = calloc(size, sizeof(win*));
+  if (unlikely(!_win_table)) {
+    fprintf(stderr, "fastcompmgr error: failed to allocate window table\n");
+    exit(1);
+  }
+  _win_table_size = size;
+  for (unsigned i = 0; i < old_size; i++) {
+    win *w, *next;
+    for (w = old[i]; w; w = next) {
+      next = w->hash_next;
+      unsigned h = _win_hash(w->id);
+      w->hash_next = _win_table[h];
+      _win_table[h] = w;
+    }
+  }
+  free(old);
+}
+
+
+void win_table_insert(win *w) {
+  if (unlikely(_win_table_count >= _win_table_size)) {
+    _win_table_resize(_win_table_size ? _win_table_size * 2 : 256);
+  }
+  unsigned h = _win_hash(w->id);
+  w->hash_next = _win_table[h];
+  _win_table[h] = w;
+  _win_table_count++;
+}
+
+
+void win_table_remove(win *w) {
+  win **prev;
+  if (unlikely(!_win_table)) return;
+  for (prev = &_win_table[_win_hash(w->id)]; *prev; prev = &(*prev)->hash_next) {
+    if (*prev == w) {
+      *prev = w->hash_next;
+      w->hash_next = NULL;
+      _win_table_count--;
+      return;
+    }
+  }
+}
+
+
+void win_list_unlink(win *w) {
+  if (w->prev) w->prev->next = w->next;
+  else list = w->next;
+  if (w->next) w->next->prev = w->prev;
+  else _list_tail = w->prev;
+  w->next = w->prev = NULL;
+}
+
+
+/// Insert the unlinked w directly above below, at the bottom, if below is NULL.
+void win_list_insert_above(win *w, win *below) {
+  w->next = below;
+  w->prev = below ? below->prev : _list_tail;
+  if (w->prev) w->prev->next = w;
+  else list = w;
+  if (below) below->prev = w;
+  else _list_tail = w;
+}
+
+
 win* find_win(Window id) {
   win *w;
-  for (w = list; w; w = w->next) {
-    if (w->id == id && !w->destroyed)
+  g_stats.win_lookups[g_stats_event]++;
+  if (unlikely(!_win_table)) return NULL;
+  for (w = _win_table[_win_hash(id)]; w; w = w->hash_next) {
+    g_stats.win_lookup_steps[g_stats_event]++;
+    if (w->id == id)
       return w;
   }
   return NULL;
@@ -84,7 +170,6 @@ win* find_win_any_parent(Window w) {
   Window *children;
   win* res = NULL;
   unsigned int nchildren;
-  // FIXME: find_win should rather return the window in constant time
   if((res=find_win(w)) != NULL){
       return res;
   }
@@ -7,6 +7,8 @@
 #include <X11/extensions/Xdamage.h>
 #include <X11/extensions/Xrender.h>
 
+#include "comp_rect.h"
+
 #if COMPOSITE_MAJOR > 0 || COMPOSITE_MINOR >= 2
 #define HAS_NAME_WINDOW_PIXMAP 1
 #endif
@@ -43,6 +45,14 @@ typedef enum {
 } shadowtype;
 
 
+// Whether the bounding region of the window is set by the Shape extension
+typedef enum {
+  SHAPED_UNKNOWN, // MUST ALWAYS STAY first, due to init optimization in add_win
+  SHAPED_YES,
+  SHAPED_NO
+} shapedtype;
+
+
 // _NET_WM_STATE is _NET_WM_STATE_HIDDEN (and not _FOCUSED)
 typedef enum {
   HIDDEN_UNKNOWN, // MUST ALWAYS STAY first, due to init optimization in add_win
@@ -52,8 +62,14 @@ typedef enum {
 } hiddentype;
 
 
+// DamageNotify areas kept per window until the next flush_damage. Beyond this
+// many, they are merged into their bounding box.
+#define WIN_DAMAGE_RECTS 8
+
 typedef struct _win {
-  struct _win *next;
+  struct _win *next; // the window below, s. list
+  struct _win *prev; // the window above
+  struct _win *hash_next; // next window in the same find_win bucket
   Window id;
 #if HAS_NAME_WINDOW_PIXMAP
   Pixmap pixmap;
@@ -69,9 +85,19 @@ typedef struct _win {
   Picture picture;
   Picture alpha_pict;
   Picture alpha_border_pict;
+  unsigned char alpha_level, alpha_border_level; // s. get_alpha_pict
   Picture shadow_pict;
-  XserverRegion border_size;
-  XserverRegion extents;
+  bool damage_rearm; // damage reported since the last frame, s. rearm_damage
+  bool damage_queued; // s. queue_damage
+  long damage_time; // when the first of the queued damage was read
+  int num_damage_rects;
+  XRectangle damage_rects[WIN_DAMAGE_RECTS]; // relative to the window
+  CompRegion border_size; // bounding region in root coordinates
+  bool border_size_valid;
+  shapedtype shaped_type;
+  CompRegion shape; // bounding region relative to the window, if SHAPED_YES
+  bool has_extents;
+  XRectangle extents_rect; // the window and its shadow, s. win_extents
   Picture shadow;
   int shadow_dx;
   int shadow_dy;
@@ -82,9 +108,9 @@ typedef struct _win {
   hiddentype hidden_type;
   wintype window_type;
   shadowtype shadow_type;
-  unsigned long damage_sequence; /* sequence when damage was created */
   Bool destroyed;
   Bool paint_needed;
+  bool occlusion_dirty; // paint_needed must be recomputed down to here
   unsigned int left_width;
   unsigned int right_width;
   unsigned int top_width;
@@ -92,18 +118,25 @@ typedef struct _win {
 
   Bool need_configure;
   bool configure_size_changed;
+  int resize_time; // of the last size change, in milliseconds (s. win_resizing)
   XConfigureEvent queue_configure;
 
   /* for drawing translucent windows */
-  XserverRegion border_clip;
+  CompRegion border_clip;
   struct _win *prev_trans;
 } win;
 
 
+// The stack of windows, topmost first
 extern win *list;
 
 win* find_win(Window id);
 win* find_win_any_parent(Window w);
+void win_table_insert(win *w);
+void win_table_remove(win *w);
+
+void win_list_unlink(win *w);
+void win_list_insert_above(win *w, win *below);
 
 bool win_state_is_hidden(Window window);
 bool win_is_client(Window window);
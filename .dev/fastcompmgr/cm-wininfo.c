@@ -0,0 +1,323 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+#include <xcb/xproto.h>
+
+#include "cm-wininfo.h"
+#include "cm-global.h"
+#include "cm-util.h"
+
+/*
+ * Pipelined window discovery. Looking up a window's attributes, type, client
+ * and properties with Xlib costs several round-trips, and walking its tree for
+ * the client or type costs some more per level. Here, the requests for all
+ * windows are sent as XCB cookies first and the replies are collected
+ * afterwards, one tree level at a time. So discovering any number of windows
+ * costs about one round-trip per tree level (usually two or three).
+ */
+
+// Deeper trees are left to the synchronous fallbacks (s. WinInfo.complete).
+#define WININFO_MAX_DEPTH 8
+
+typedef struct {
+  Window id;
+  int top;         // index of the toplevel window in out
+  int first_child; // index of the first child node, -1 if not fetched
+  int nchildren;
+  bool has_wm_state;
+  bool hidden;
+  bool has_extents;
+  unsigned int extents[4];
+  wintype type;
+  xcb_get_property_cookie_t wm_state_c, type_c, net_wm_state_c, extents_c;
+  xcb_query_tree_cookie_t tree_c;
+  xcb_query_tree_reply_t *tree;
+} _Node;
+
+
+static xcb_get_property_reply_t *
+_property_reply(xcb_connection_t *c, xcb_get_property_cookie_t cookie) {
+  xcb_generic_error_t *err = NULL;
+  xcb_get_property_reply_t *r = xcb_get_property_reply(c, cookie, &err);
+  free(err);
+  return r;
+}
+
+static void
+_send(xcb_connection_t *c, _Node *node, int what) {
+  node->wm_state_c = xcb_get_property(c, 0, node->id, atom_wm_state,
+                                      XCB_GET_PROPERTY_TYPE_ANY, 0, 0);
+  node->type_c = xcb_get_property(c, 0, node->id, atom_win_type,
+                                  XCB_ATOM_ATOM, 0, 64);
+  if (what & WININFO_ATTRS) {
+    node->net_wm_state_c = xcb_get_property(c, 0, node->id, atom_net_wm_state,
+                                            XCB_ATOM_ATOM, 0, 64);
+    node->extents_c = xcb_get_property(c, 0, node->id, atom_net_frame_extents,
+                                       XCB_GET_PROPERTY_TYPE_ANY, 0, 4);
+  }
+  node->tree_c = xcb_query_tree(c, node->id);
+}
+
+static void
+_receive(xcb_connection_t *c, _Node *node, int what, const Atom *win_types) {
+  xcb_get_property_reply_t *r;
+  xcb_generic_error_t *err = NULL;
+
+  if ((r = _property_reply(c, node->wm_state_c))) {
+    node->has_wm_state = r->type != XCB_NONE;
+    free(r);
+  }
+
+  if ((r = _property_reply(c, node->type_c))) {
+    if (r->format == 32) {
+      xcb_atom_t *atoms = xcb_get_property_value(r);
+      int n = xcb_get_property_value_length(r) / 4;
+      for (int k = 0; k < n && node->type == WINTYPE_UNKNOWN; k++) {
+        for (int i = 1; i < NUM_WINTYPES; i++) {
+          if (atoms[k] == win_types[i]) {
+            node->type = i;
+            break;
+          }
+        }
+      }
+    }
+    free(r);
+  }
+
+  if (what & WININFO_ATTRS) {
+    if ((r = _property_reply(c, node->net_wm_state_c))) {
+      if (r->format == 32) {
+        xcb_atom_t *atoms = xcb_get_property_value(r);
+        int n = xcb_get_property_value_length(r) / 4;
+        // s. win_state_is_hidden
+        for (int k = 0; k < n; k++) {
+          if (atoms[k] == atom_net_wm_state_hidden) {
+            node->hidden = true;
+          } else if (atoms[k] == atom_net_wm_state_focused) {
+            node->hidden = false;
+            break;
+          }
+        }
+      }
+      free(r);
+    }
+    if ((r = _property_reply(c, node->extents_c))) {
+      if (r->format == 32 && r->value_len == 4 && r->bytes_after == 0) {
+        memcpy(node->extents, xcb_get_property_value(r), sizeof(node->extents));
+        node->has_extents = true;
+      }
+      free(r);
+    }
+  }
+
+  node->tree = xcb_query_tree_reply(c, node->tree_c, &err);
+  free(err);
+}
+
+/// Depth-first, like find_client_win: the first window having WM_STATE
+static int
+_find_client(_Node *nodes, int i, bool *complete) {
+  if (nodes[i].has_wm_state) return i;
+  if (nodes[i].first_child < 0) {
+    if (nodes[i].nchildren) *complete = false;
+    return -1;
+  }
+  for (int k = 0; k < nodes[i].nchildren; k++) {
+    int r = _find_client(nodes, nodes[i].first_child + k, complete);
+    if (r >= 0) return r;
+  }
+  return -1;
+}
+
+/// Depth-first, like determine_wintype: the first known window type
+static wintype
+_find_type(_Node *nodes, int i, bool *complete) {
+  if (nodes[i].type != WINTYPE_UNKNOWN) return nodes[i].type;
+  if (nodes[i].first_child < 0) {
+    if (nodes[i].nchildren) *complete = false;
+    return WINTYPE_UNKNOWN;
+  }
+  for (int k = 0; k < nodes[i].nchildren; k++) {
+    wintype t = _find_type(nodes, nodes[i].first_child + k, complete);
+    if (t != WINTYPE_UNKNOWN) return t;
+  }
+  return WINTYPE_UNKNOWN;
+}
+
+static Visual *
+_find_visual(Screen *s, VisualID id) {
+  for (int d = 0; d < s->ndepths; d++) {
+    for (int v = 0; v < s->depths[d].nvisuals; v++) {
+      if (s->depths[d].visuals[v].visualid == id) return &s->depths[d].visuals[v];
+    }
+  }
+  return NULL;
+}
+
+static void
+_fill_attributes(XWindowAttributes *a, xcb_get_window_attributes_reply_t *ar,
+                 xcb_get_geometry_reply_t *gr) {
+  Screen *s = ScreenOfDisplay(g_dpy, g_screen);
+
+  a->x = gr->x;
+  a->y = gr->y;
+  a->width = gr->width;
+  a->height = gr->height;
+  a->border_width = gr->border_width;
+  a->depth = gr->depth;
+  a->visual = _find_visual(s, ar->visual);
+  a->root = gr->root;
+  a->class = ar->_class;
+  a->bit_gravity = ar->bit_gravity;
+  a->win_gravity = ar->win_gravity;
+  a->backing_store = ar->backing_store;
+  a->backing_planes = ar->backing_planes;
+  a->backing_pixel = ar->backing_pixel;
+  a->save_under = ar->save_under;
+  a->colormap = ar->colormap;
+  a->map_installed = ar->map_is_installed;
+  a->map_state = ar->map_state;
+  a->all_event_masks = ar->all_event_masks;
+  a->your_event_mask = ar->your_event_mask;
+  a->do_not_propagate_mask = ar->do_not_propagate_mask;
+  a->override_redirect = ar->override_redirect;
+  a->screen = s;
+}
+
+/// Fetch what's needed about the toplevel windows ids[0..n) into out, s. WinInfo.
+/// The type and client are always looked up, further data depending on what.
+void wininfo_fetch(Window *ids, int n, WinInfo *out, int what, const Atom *win_types) {
+  xcb_connection_t *c = XGetXCBConnection(g_dpy);
+  xcb_get_window_attributes_cookie_t *attr_c = NULL;
+  xcb_get_geometry_cookie_t *geom_c = NULL;
+  xcb_get_property_cookie_t *opacity_c = NULL;
+  _Node *nodes;
+  int nnodes = n;
+  int cap = n ? n : 1;
+  int level_start = 0;
+  int depth, i;
+
+  nodes = calloc(cap, sizeof(_Node));
+  if (what & WININFO_ATTRS) {
+    attr_c = malloc(cap * sizeof(*attr_c));
+    geom_c = malloc(cap * sizeof(*geom_c));
+  }
+  if (what & WININFO_OPACITY) opacity_c = malloc(cap * sizeof(*opacity_c));
+  if (unlikely(!nodes || ((what & WININFO_ATTRS) && (!attr_c || !geom_c)) ||
+               ((what & WININFO_OPACITY) && !opacity_c))) {
+    fprintf(stderr, "fastcompmgr error: failed to allocate window info\n");
+    exit(1);
+  }
+
+  // Xlib may still buffer requests which must go out before ours.
+  XFlush(g_dpy);
+
+  for (i = 0; i < n; i++) {
+    memset(&out[i], 0, sizeof(WinInfo));
+    out[i].id = ids[i];
+    out[i].complete = true;
+    nodes[i].id = ids[i];
+    nodes[i].top = i;
+    nodes[i].first_child = -1;
+    if (what & WININFO_ATTRS) {
+      attr_c[i] = xcb_get_window_attributes(c, ids[i]);
+      geom_c[i] = xcb_get_geometry(c, ids[i]);
+    }
+    if (what & WININFO_OPACITY) {
+      opacity_c[i] = xcb_get_property(c, 0, ids[i], atom_opacity,
+                                      XCB_ATOM_CARDINAL, 0, 1);
+    }
+  }
+
+  for (depth = 0; level_start < nnodes; depth++) {
+    int level_end = nnodes;
+    for (i = level_start; i < level_end; i++) _send(c, &nodes[i], what);
+    for (i = level_start; i < level_end; i++) _receive(c, &nodes[i], what, win_types);
+
+    // Descend, where the client or the type are still unknown.
+    for (i = level_start; i < level_end; i++) {
+      xcb_query_tree_reply_t *tree = nodes[i].tree;
+      nodes[i].tree = NULL;
+      if (!tree) continue;
+      nodes[i].nchildren = xcb_query_tree_children_length(tree);
+      if (nodes[i].nchildren && (!nodes[i].has_wm_state ||
+                                 nodes[i].type == WINTYPE_UNKNOWN)) {
+        if (depth + 1 >= WININFO_MAX_DEPTH) {
+          // _find_client/_find_type flag it incomplete
+          free(tree);
+          continue;
+        }
+        if (nnodes + nodes[i].nchildren > cap) {
+          while (nnodes + nodes[i].nchildren > cap) cap *= 2;
+          _Node *tmp = realloc(nodes, cap * sizeof(_Node));
+          if (unlikely(!tmp)) {
+            fprintf(stderr, "fastcompmgr error: failed to allocate window info\n");
+            exit(1);
+          }
+          nodes = tmp;
+        }
+        xcb_window_t *children = xcb_query_tree_children(tree);
+        nodes[i].first_child = nnodes;
+        for (int k = 0; k < nodes[i].nchildren; k++) {
+          memset(&nodes[nnodes], 0, sizeof(_Node));
+          nodes[nnodes].id = children[k];
+          nodes[nnodes].top = nodes[i].top;
+          nodes[nnodes].first_child = -1;
+          nnodes++;
+        }
+      }
+      free(tree);
+    }
+    level_start = level_end;
+  }
+
+  for (i = 0; i < n; i++) {
+    WinInfo *info = &out[i];
+    int client = _find_client(nodes, i, &info->complete);
+
+    info->type = _find_type(nodes, i, &info->complete);
+    if (info->type == WINTYPE_UNKNOWN) info->type = WINTYPE_NORMAL;
+    info->client = (client >= 0) ? nodes[client].id : 0;
+
+    if (what & WININFO_ATTRS) {
+      xcb_generic_error_t *err_a = NULL, *err_g = NULL;
+      xcb_get_window_attributes_reply_t *ar =
+        xcb_get_window_attributes_reply(c, attr_c[i], &err_a);
+      xcb_get_geometry_reply_t *gr = xcb_get_geometry_reply(c, geom_c[i], &err_g);
+      free(err_a);
+      free(err_g);
+      if (ar && gr) {
+        _fill_attributes(&info->a, ar, gr);
+        info->valid = true;
+      }
+      free(ar);
+      free(gr);
+
+      _Node *cn = &nodes[(client >= 0) ? client : i];
+      info->hidden = cn->hidden;
+      if (client >= 0 && cn->has_extents) {
+        memcpy(info->frame_extents, cn->extents, sizeof(info->frame_extents));
+      }
+    }
+    if (what & WININFO_OPACITY) {
+      xcb_get_property_reply_t *r = _property_reply(c, opacity_c[i]);
+      if (r && r->format == 32 && r->value_len >= 1) {
+        memcpy(&info->opacity, xcb_get_property_value(r), sizeof(uint32_t));
+        info->has_opacity = true;
+      }
+      free(r);
+    }
+  }
+
+  free(nodes);
+  free(attr_c);
+  free(geom_c);
+  free(opacity_c);
+  // Until Xlib takes the connection back, NextRequest(dpy) does not count our
+  // requests, and serials taken with it (s. set_ignore) would be off.
+  XFlush(g_dpy);
+}
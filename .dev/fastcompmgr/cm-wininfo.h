@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <X11/Xlib.h>
+
+#include "cm-window.h"
+
+// What to fetch besides the window type and the client (s. wininfo_fetch)
+#define WININFO_ATTRS   (1 << 0) // XWindowAttributes, frame extents, hidden state
+#define WININFO_OPACITY (1 << 1) // _NET_WM_WINDOW_OPACITY
+
+/// Everything add_win and map_win need to know about a toplevel window.
+typedef struct {
+  Window id;
+  bool valid;              // false, if the window vanished (or no attributes asked)
+  XWindowAttributes a;
+  Window client;           // the first window with WM_STATE in the tree, or 0
+  bool hidden;             // _NET_WM_STATE of the client (or the window) is hidden
+  unsigned int frame_extents[4]; // _NET_FRAME_EXTENTS of the client: l, r, t, b
+  bool has_opacity;
+  unsigned int opacity;
+  wintype type;            // the first known window type in the tree
+  bool complete;           // false, if the tree was too deep to fetch completely
+} WinInfo;
+
+void wininfo_fetch(Window *ids, int n, WinInfo *out, int what, const Atom *win_types);
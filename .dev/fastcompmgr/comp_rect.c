@@ -1,62 +1,392 @@
 
-#include "comp_rect.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "comp_rect.h"
 
 
-/// Returns true, if r1 fully contains r2
-static bool rect_contains(CompRect* r1, CompRect* r2){
-    return r1->x1 <= r2->x1 && r1->y1 <= r2->y1 &&
-            r1->x2 >= r2->x2 && r1->y2 >=r2->y2;
+void comp_region_clear(CompRegion* reg){
+    reg->n = 0;
 }
 
+void comp_region_free(CompRegion* reg){
+    free(reg->boxes);
+    reg->boxes = NULL;
+    reg->n = reg->cap = 0;
+}
 
-static bool rects_are_intersecting(CompRect* r1, CompRect* r2)
-{
-    // if the left point of one rect is greater
-    // than the right one of the other, nothing intersects.
-    if(r1->x1 > r2->x2 || r2->x1 > r1->x2){
-        return false;
+static bool region_reserve(CompRegion* reg, int n){
+    if(n <= reg->cap){
+        return true;
+    }
+    int cap = reg->cap ? reg->cap : 16;
+    while(cap < n){
+        cap *= 2;
     }
-    if(r1->y1 > r2->y2 || r2->y1 > r1->y2){
+    CompBox* boxes = realloc(reg->boxes, cap * sizeof(CompBox));
+    if(!boxes){
         return false;
     }
+    reg->boxes = boxes;
+    reg->cap = cap;
     return true;
 }
 
-/// Check if we can omit painting a window (rect). E.g., a window
-/// completely occluded by another one, does not need to be
-/// painted. Further, we try to select the largest possible ignore region
-/// Based on window and intersection areas.
-bool rect_paint_needed(CompRect* ignore_reg, CompRect* reg){
-    if(rect_contains(ignore_reg, reg)){
-        // the ignore-region completely occludes the window.
+/// Returns the index of the first box of the band following the one starting at i
+static int band_end(const CompRegion* reg, int i){
+    int y1 = reg->boxes[i].y1;
+    while(i < reg->n && reg->boxes[i].y1 == y1){
+        i++;
+    }
+    return i;
+}
+
+/// Append the span [x1, x2) to the band starting at out->boxes[start], merging
+/// it with the last span, if they overlap or touch.
+static void append_span(CompRegion* out, int start, short y1, short y2,
+                        short x1, short x2){
+    if(out->n > start && x1 <= out->boxes[out->n - 1].x2){
+        if(x2 > out->boxes[out->n - 1].x2){
+            out->boxes[out->n - 1].x2 = x2;
+        }
+        return;
+    }
+    CompBox b = {.x1 = x1, .y1 = y1, .x2 = x2, .y2 = y2};
+    out->boxes[out->n++] = b;
+}
+
+/// Finish the band ending at y2, starting at out->boxes[start]: if its x-spans equal
+/// those of the previous band and both bands touch, the previous band is
+/// extended instead.
+static void finish_band(CompRegion* out, int* prev_band, int start, short y2){
+    if(out->n == start){
+        return;
+    }
+    if(*prev_band >= 0 && out->boxes[*prev_band].y2 == out->boxes[start].y1 &&
+            start - *prev_band == out->n - start){
+        int k;
+        for(k = 0; k < out->n - start; k++){
+            if(out->boxes[*prev_band + k].x1 != out->boxes[start + k].x1 ||
+                    out->boxes[*prev_band + k].x2 != out->boxes[start + k].x2){
+                break;
+            }
+        }
+        if(k == out->n - start){
+            for(k = *prev_band; k < start; k++){
+                out->boxes[k].y2 = y2;
+            }
+            out->n = start;
+            return;
+        }
+    }
+    *prev_band = start;
+}
+
+/// Append the band [y1, y2) of boxes src[0..n) plus the span [x1, x2) (if x1 < x2)
+/// to out, merging overlapping or touching spans. If the x-spans equal those of
+/// the previous band and both bands touch, the previous band is extended instead.
+static void append_band(CompRegion* out, int* prev_band, short y1, short y2,
+                        CompBox* src, int n, short x1, short x2){
+    int start = out->n;
+    int i = 0;
+    bool span_pending = x1 < x2;
+
+    while(i < n || span_pending){
+        if(span_pending && (i == n || x1 < src[i].x1)){
+            append_span(out, start, y1, y2, x1, x2);
+            span_pending = false;
+        } else {
+            append_span(out, start, y1, y2, src[i].x1, src[i].x2);
+            i++;
+        }
+    }
+    finish_band(out, prev_band, start, y2);
+}
+
+/// Append the band [y1, y2) combining the x-spans of a[0..na) and b[0..nb) by op.
+/// out must have room for na + nb more boxes.
+static void op_band(CompRegion* out, int* prev_band, short y1, short y2,
+                    const CompBox* a, int na, const CompBox* b, int nb,
+                    CompRegionOp op){
+    int start = out->n;
+    int i = 0, j = 0;
+
+    switch(op){
+    case COMP_REGION_UNION:
+        while(i < na || j < nb){
+            if(j == nb || (i < na && a[i].x1 < b[j].x1)){
+                append_span(out, start, y1, y2, a[i].x1, a[i].x2);
+                i++;
+            } else {
+                append_span(out, start, y1, y2, b[j].x1, b[j].x2);
+                j++;
+            }
+        }
+        break;
+    case COMP_REGION_INTERSECT:
+        while(i < na && j < nb){
+            short x1 = a[i].x1 > b[j].x1 ? a[i].x1 : b[j].x1;
+            short x2 = a[i].x2 < b[j].x2 ? a[i].x2 : b[j].x2;
+            if(x1 < x2){
+                append_span(out, start, y1, y2, x1, x2);
+            }
+            if(a[i].x2 < b[j].x2){
+                i++;
+            } else {
+                j++;
+            }
+        }
+        break;
+    case COMP_REGION_SUBTRACT:
+        for(; i < na; i++){
+            short x1 = a[i].x1;
+            // spans of b left of a[i] are left of all following ones, too
+            while(j < nb && b[j].x2 <= x1){
+                j++;
+            }
+            for(int k = j; k < nb && b[k].x1 < a[i].x2; k++){
+                if(b[k].x1 > x1){
+                    append_span(out, start, y1, y2, x1, b[k].x1);
+                }
+                if(b[k].x2 > x1){
+                    x1 = b[k].x2;
+                }
+            }
+            if(x1 < a[i].x2){
+                append_span(out, start, y1, y2, x1, a[i].x2);
+            }
+        }
+        break;
+    }
+    finish_band(out, prev_band, start, y2);
+}
+
+/// Add the rect r to the region. Returns false on allocation failure, in which
+/// case the region is left untouched.
+bool comp_region_union_rect(CompRegion* reg, CompRect* r){
+    if(r->x1 >= r->x2 || r->y1 >= r->y2){
+        return true;
+    }
+    // The rect splits at most two input bands, so every input box ends up in at
+    // most three output bands. Further, the rect adds at most one box per output
+    // band, of which there are at most 2 * n + 3 (including the gaps).
+    CompRegion out = {0};
+    if(!region_reserve(&out, 5 * reg->n + 3)){
         return false;
     }
-    if(! rects_are_intersecting(ignore_reg, reg)){
-        // KISS and just use the greater rect as new ignore region.
-        if(reg->w*reg->h > ignore_reg->w*ignore_reg->h){
-            *ignore_reg = *reg;
+
+    int prev_band = -1;
+    int i = 0;
+    short y = r->y1;
+    if(reg->n && reg->boxes[0].y1 < y){
+        y = reg->boxes[0].y1;
+    }
+
+    while(i < reg->n || y < r->y2){
+        CompBox* band = NULL;
+        int band_n = 0;
+        short ynext;
+
+        if(i < reg->n && reg->boxes[i].y1 <= y){
+            // inside the current input band
+            int e = band_end(reg, i);
+            band = &reg->boxes[i];
+            band_n = e - i;
+            ynext = band->y2;
+            if(r->y1 > y && r->y1 < ynext) ynext = r->y1;
+            if(r->y2 > y && r->y2 < ynext) ynext = r->y2;
+            if(ynext == band->y2){
+                i = e;
+            }
+        } else {
+            // between input bands (or after them)
+            ynext = r->y2;
+            if(r->y1 > y) ynext = r->y1;
+            if(i < reg->n && reg->boxes[i].y1 < ynext) ynext = reg->boxes[i].y1;
+            if(ynext <= y){
+                // r already done, jump to the next input band
+                y = reg->boxes[i].y1;
+                continue;
+            }
+        }
+
+        bool in_rect = r->y1 <= y && ynext <= r->y2;
+        append_band(&out, &prev_band, y, ynext, band, band_n,
+                    in_rect ? r->x1 : 0, in_rect ? r->x2 : 0);
+        if(band && ynext < band->y2){
+            // split band: continue within it
+            CompBox* b;
+            for(b = band; b < band + band_n; b++){
+                b->y1 = ynext;
+            }
+        }
+        y = ynext;
+    }
+
+    free(reg->boxes);
+    *reg = out;
+    return true;
+}
+
+/// dst = a op b. dst may be a or b. Returns false on allocation failure, in
+/// which case dst is left untouched.
+bool comp_region_op(CompRegion* dst, const CompRegion* a, const CompRegion* b,
+                    CompRegionOp op){
+    CompRegion out = {0};
+    int prev_band = -1;
+    int ia = 0, ib = 0;
+    short y = 0;
+
+    if(a->n && (!b->n || a->boxes[0].y1 < b->boxes[0].y1)){
+        y = a->boxes[0].y1;
+    } else if(b->n){
+        y = b->boxes[0].y1;
+    }
+
+    while(ia < a->n || ib < b->n){
+        if(op == COMP_REGION_INTERSECT && (ia == a->n || ib == b->n)){
+            break;
+        }
+        if(op == COMP_REGION_SUBTRACT && ia == a->n){
+            break;
+        }
+        const CompBox* ba = ia < a->n ? &a->boxes[ia] : NULL;
+        const CompBox* bb = ib < b->n ? &b->boxes[ib] : NULL;
+        bool in_a = ba && ba->y1 <= y;
+        bool in_b = bb && bb->y1 <= y;
+        int ea = in_a ? band_end(a, ia) : ia;
+        int eb = in_b ? band_end(b, ib) : ib;
+        short ynext;
+
+        if(!in_a && !in_b){
+            // a gap in both: jump to the next band
+            y = (ba && (!bb || ba->y1 < bb->y1)) ? ba->y1 : bb->y1;
+            continue;
+        }
+        ynext = SHRT_MAX;
+        if(ba){
+            ynext = in_a ? ba->y2 : ba->y1;
+        }
+        if(bb){
+            short yb = in_b ? bb->y2 : bb->y1;
+            if(yb < ynext) ynext = yb;
         }
+
+        if(!region_reserve(&out, out.n + (ea - ia) + (eb - ib))){
+            comp_region_free(&out);
+            return false;
+        }
+        op_band(&out, &prev_band, y, ynext, ba, ea - ia, bb, eb - ib, op);
+
+        y = ynext;
+        if(in_a && ynext == ba->y2){
+            ia = ea;
+        }
+        if(in_b && ynext == bb->y2){
+            ib = eb;
+        }
+    }
+
+    free(dst->boxes);
+    *dst = out;
+    return true;
+}
+
+/// dst = src. Returns false on allocation failure.
+bool comp_region_copy(CompRegion* dst, const CompRegion* src){
+    if(dst == src){
+        return true;
+    }
+    if(!region_reserve(dst, src->n)){
+        return false;
+    }
+    if(src->n){
+        memcpy(dst->boxes, src->boxes, src->n * sizeof(CompBox));
+    }
+    dst->n = src->n;
+    return true;
+}
+
+/// Set the region to the box b (to the empty region, if b is empty).
+bool comp_region_set_box(CompRegion* reg, const CompBox* b){
+    reg->n = 0;
+    if(b->x1 >= b->x2 || b->y1 >= b->y2){
         return true;
     }
+    if(!region_reserve(reg, 1)){
+        return false;
+    }
+    reg->boxes[0] = *b;
+    reg->n = 1;
+    return true;
+}
+
+void comp_region_translate(CompRegion* reg, int dx, int dy){
+    for(int i = 0; i < reg->n; i++){
+        reg->boxes[i].x1 += dx;
+        reg->boxes[i].y1 += dy;
+        reg->boxes[i].x2 += dx;
+        reg->boxes[i].y2 += dy;
+    }
+}
+
+/// Sets box to the bounding box of the region. Returns false, if it is empty.
+bool comp_region_extents(const CompRegion* reg, CompBox* box){
+    if(!reg->n){
+        box->x1 = box->y1 = box->x2 = box->y2 = 0;
+        return false;
+    }
+    box->x1 = reg->boxes[0].x1;
+    box->x2 = reg->boxes[0].x2;
+    box->y1 = reg->boxes[0].y1;
+    box->y2 = reg->boxes[reg->n - 1].y2;
+    for(int i = 1; i < reg->n; i++){
+        if(reg->boxes[i].x1 < box->x1) box->x1 = reg->boxes[i].x1;
+        if(reg->boxes[i].x2 > box->x2) box->x2 = reg->boxes[i].x2;
+    }
+    return true;
+}
 
-    // calculate the intersection rect.
-    short x1 = (ignore_reg->x1 > reg->x1) ? ignore_reg->x1 : reg->x1;
-    short x2 = (ignore_reg->x2 < reg->x2) ? ignore_reg->x1 : reg->x1;
-    short y1 = (ignore_reg->y1 > reg->y1) ? ignore_reg->y1 : reg->y1;
-    short y2 = (ignore_reg->y2 < reg->y2) ? ignore_reg->y1 : reg->y1;
-    short w = x2 - x1;
-    short h = y2 - y1;
+/// Returns true, if the region fully contains r
+bool comp_region_contains_rect(CompRegion* reg, CompRect* r){
+    short y = r->y1;
+    int i = 0;
 
-    // KISS and just use the biggest rect as new ignore rect
-    if(reg->w*reg->h > ignore_reg->w*ignore_reg->h){
-        *ignore_reg = *reg;
+    if(r->x1 >= r->x2 || r->y1 >= r->y2){
+        return true;
+    }
+    // skip bands above r
+    while(i < reg->n && reg->boxes[i].y2 <= y){
+        i++;
+    }
+    while(y < r->y2){
+        if(i == reg->n || reg->boxes[i].y1 > y){
+            // a gap between bands
+            return false;
+        }
+        int e = band_end(reg, i);
+        bool covered = false;
+        for(; i < e; i++){
+            if(reg->boxes[i].x1 <= r->x1 && reg->boxes[i].x2 >= r->x2){
+                covered = true;
+            }
+        }
+        if(!covered){
+            return false;
+        }
+        y = reg->boxes[e - 1].y2;
     }
-    if(w*h > ignore_reg->w*ignore_reg->h){
-        CompRect r_intersect = {.x1 = x1, .y1 = y1,
-                  .x2 = x2, .y2 = y2,
-                  .w = w, .h = h };
-        *ignore_reg = r_intersect;
+    return true;
+}
+
+/// Check if we can omit painting a window (rect). E.g., a window
+/// completely occluded by the union of the opaque windows above it, does not
+/// need to be painted. Otherwise the window is added to that union.
+bool rect_paint_needed(CompRegion* ignore_reg, CompRect* reg){
+    if(comp_region_contains_rect(ignore_reg, reg)){
+        return false;
     }
+    comp_region_union_rect(ignore_reg, reg);
     return true;
 }
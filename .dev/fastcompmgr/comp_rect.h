@@ -11,6 +11,39 @@ typedef struct {
     short h;
 } CompRect;
 
+typedef struct {
+    short x1;
+    short y1;
+    short x2;
+    short y2;
+} CompBox;
+
+/// A client side region, stored as y-x banded list of boxes (like pixman):
+/// boxes are sorted by y1, then x1. All boxes of a band share y1 and y2,
+/// boxes of a band do not touch and vertically adjacent bands with the same
+/// x-spans are coalesced.
+typedef struct {
+    CompBox* boxes;
+    int n;
+    int cap;
+} CompRegion;
+
+typedef enum {
+    COMP_REGION_UNION,
+    COMP_REGION_INTERSECT,
+    COMP_REGION_SUBTRACT
+} CompRegionOp;
+
 
+void comp_region_clear(CompRegion* reg);
+void comp_region_free(CompRegion* reg);
+bool comp_region_union_rect(CompRegion* reg, CompRect* r);
+bool comp_region_contains_rect(CompRegion* reg, CompRect* r);
+bool comp_region_op(CompRegion* dst, const CompRegion* a, const CompRegion* b,
+                    CompRegionOp op);
+bool comp_region_copy(CompRegion* dst, const CompRegion* src);
+bool comp_region_set_box(CompRegion* reg, const CompBox* b);
+void comp_region_translate(CompRegion* reg, int dx, int dy);
+bool comp_region_extents(const CompRegion* reg, CompBox* box);
 
-bool rect_paint_needed(CompRect* ignore_reg, CompRect* reg);
+bool rect_paint_needed(CompRegion* ignore_reg, CompRect* reg);
@@ -0,0 +1,66 @@
+/*
+ * Query a running fastcompmgr, started with --control-socket, and print its
+ * answer.
+ *
+ * Usage: fastcompmgr-ctl [-s socket] [stats|reset]
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int
+main(int argc, char **argv) {
+  const char *path = "@fastcompmgr";
+  const char *cmd = "stats";
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  socklen_t len;
+  char buf[4096];
+  ssize_t r;
+  size_t n;
+  int fd, o;
+
+  while ((o = getopt(argc, argv, "s:h")) != -1) {
+    switch (o) {
+    case 's': path = optarg; break;
+    default:
+      fprintf(stderr, "usage: %s [-s socket] [stats|reset]\n"
+              "  socket defaults to @fastcompmgr, @ denotes the abstract namespace\n",
+              argv[0]);
+      return o == 'h' ? 0 : 2;
+    }
+  }
+  if (optind < argc) cmd = argv[optind];
+
+  n = strlen(path);
+  if (n < 2 || n >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "%s: invalid socket path '%s'\n", argv[0], path);
+    return 2;
+  }
+  memcpy(addr.sun_path, path, n);
+  if (path[0] == '@') {
+    addr.sun_path[0] = '\0';
+    len = offsetof(struct sockaddr_un, sun_path) + n;
+  } else {
+    len = offsetof(struct sockaddr_un, sun_path) + n + 1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, len) < 0) {
+    fprintf(stderr, "%s: cannot connect to %s: ", argv[0], path);
+    perror(NULL);
+    return 1;
+  }
+  if (dprintf(fd, "%s\n", cmd) < 0) {
+    perror(argv[0]);
+    return 1;
+  }
+  while ((r = read(fd, buf, sizeof(buf))) > 0) {
+    fwrite(buf, 1, r, stdout);
+  }
+  close(fd);
+  return r < 0;
+}
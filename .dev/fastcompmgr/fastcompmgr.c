@@ -11,7 +11,11 @@
  *
  */
 
+#define _GNU_SOURCE // ppoll
+
 #include <assert.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -28,14 +32,22 @@
 #include <X11/Xatom.h>
 #include <X11/extensions/Xcomposite.h>
 #include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
 #include <X11/extensions/Xrender.h>
+#include <X11/extensions/shape.h>
 
+#include "cm-ctl.h"
+#include "cm-trace.h"
 #include "cm-global.h"
 #include "cm-event.h"
+#include "cm-gauss.h"
 #include "cm-root.h"
+#include "cm-stats.h"
 #include "cm-util.h"
 #include "cm-window.h"
 #include "comp_rect.h"
+#include "cm-monitor.h"
+#include "cm-wininfo.h"
 #include "ringbuffer.h"
 
 
@@ -45,17 +57,16 @@ typedef struct _ignore {
 } ignore;
 
 
-typedef struct _conv {
-  int size;
-  double *data;
-} conv;
-
+// Fades are animated by time: the opacity moves linearly from start to finish
+// over duration, at the rate given by the fade steps (s. set_fade).
 typedef struct _fade {
   struct _fade *next;
   win *w;
   double cur;
+  double start;
   double finish;
-  double step;
+  long start_time; // microseconds
+  long duration;   // microseconds
   void (*callback) (Display *dpy, win *w);
   Display *dpy;
 } fade;
@@ -65,20 +76,42 @@ Display *dpy;
 Picture black_picture;
 Picture cshadow_picture;
 Picture root_tile;
-XserverRegion all_damage;
-XserverRegion g_xregion_tmp;
+CompRegion all_damage;
 Bool all_damage_is_dirty;
+// frames painted into root_buffer since its contents were last undefined
+static int root_buffer_age = 0;
 Bool clip_changed;
 #if HAS_NAME_WINDOW_PIXMAP
 Bool has_name_pixmap;
 #endif
 int xfixes_event, xfixes_error;
+int shape_event, shape_error;
+Bool has_shape;
 int damage_event, damage_error;
 int composite_event, composite_error;
 int render_event, render_error;
 Bool synchronize;
 int composite_opcode;
 static Bool g_paint_ignore_region_is_dirty = True;
+static int g_occlusion_dirty_count = 0; // windows with occlusion_dirty set
+static int g_damage_rearm_count = 0; // windows with damage_rearm set
+static int g_damage_queued_count = 0; // windows with damage_queued set
+static Bool print_stats = False;
+static Bool unredir_fullscreen = True;
+static Window cm_window;
+static Atom atom_frame_marker;
+static Bool g_frame_pending = False;
+static Bool g_frame_deferred = False; // a paint waits for the frame in flight
+static int g_frame_time = 0;
+static long g_frame_damage_time = 0; // when the frame in flight got damaged
+static long g_damage_origin = 0; // when the cause of added damage occurred
+static unsigned g_frame_monitors = 0; // the monitors painted by it
+static long g_frame_start_time = 0;
+static long g_frame_submit_time = 0; // when the frame in flight was sent
+static double g_paint_cost_us = 0; // moving average of frame durations
+static Bool g_unredirected = False;
+static volatile sig_atomic_t g_signal = 0;
+static sigset_t g_poll_sigmask; // while waiting in ppoll, s. signal_handler
 
 Atom win_type[NUM_WINTYPES];
 double win_type_opacity[NUM_WINTYPES];
@@ -89,7 +122,7 @@ Bool win_type_fade[NUM_WINTYPES];
 
 #define OPAQUE 0xffffffff
 
-conv *gaussian_map;
+GaussMap *gaussian_map;
 
 #define WINDOW_SOLID 0
 #define WINDOW_TRANS 1
@@ -117,7 +150,7 @@ do_configure_win(Display *dpy, win* w);
 static void
 set_paint_ignore_region_dirty(void);
 
-static XserverRegion
+static void
 win_extents(Display *dpy, win *w);
 
 int shadow_radius = 12;
@@ -128,7 +161,7 @@ double shadow_opacity = .75;
 double fade_in_step = 0.028;
 double fade_out_step = 0.03;
 int fade_delta = 10;
-int fade_time = 0;
+static long fade_deadline = 0; // the next frame tick of the fades, microseconds
 Bool fade_trans = False;
 
 double inactive_opacity = 0;
@@ -184,10 +217,19 @@ cleanup_fade(Display *dpy, win *w) {
   }
 }
 
+/// The time between two frame ticks of the fades: fade_delta, but not faster
+/// than the fastest monitor refreshes.
+static long
+fade_tick(void) {
+  long refresh_us = (long)(1000000.0 / monitors_max_refresh_hz());
+  long delta_us = fade_delta * 1000L;
+  return (delta_us > refresh_us) ? delta_us : refresh_us;
+}
+
 void
 enqueue_fade(Display *dpy, fade *f) {
   if (!fades) {
-    fade_time = get_time_in_milliseconds() + fade_delta;
+    fade_deadline = get_time_in_microseconds() + fade_tick();
   }
   f->next = fades;
   fades = f;
@@ -203,6 +245,7 @@ set_fade(Display *dpy, win *w, double start,
   f = find_fade(w);
   if (!f) {
     f = malloc(sizeof(fade));
+    if (unlikely(!f)) return;
     f->next = 0;
     f->w = w;
     f->cur = start;
@@ -217,19 +260,17 @@ set_fade(Display *dpy, win *w, double start,
 
   if (finish < 0) finish = 0;
   if (finish > 1) finish = 1;
+  // (re-)start from the current opacity, step per fade_delta
+  f->start = f->cur;
   f->finish = finish;
-
-  if (f->cur < finish) {
-    f->step = step;
-  } else if (f->cur > finish) {
-    f->step = -step;
-  }
+  f->start_time = get_time_in_microseconds();
+  f->duration = (long)(fabs(finish - f->cur) / step * fade_delta * 1000);
 
   f->callback = callback;
   w->opacity = f->cur * OPAQUE;
 
 #if 0
-  printf("set_fade start %g step %g\n", f->cur, f->step);
+  printf("set_fade start %g duration %ld\n", f->cur, f->duration);
 #endif
 
   determine_mode(dpy, w);
@@ -250,65 +291,48 @@ set_fade(Display *dpy, win *w, double start,
   w->damaged = 1;
 }
 
+/// Milliseconds until the next frame tick of the fades, -1 (no wakeups), if
+/// nothing fades.
 int
 fade_timeout(void) {
-  int now;
-  int delta;
+  long delta;
 
   if (!fades) return -1;
 
-  now = get_time_in_milliseconds();
-  delta = fade_time - now;
-
+  delta = fade_deadline - get_time_in_microseconds();
   if (delta < 0) delta = 0;
-/* printf("timeout %d\n", delta); */
 
-  return delta;
+  return (delta + 999) / 1000;
 }
 
+/// Advance all fades to the current time, if their frame tick is due. They
+/// damage their windows, which are then painted together in one frame.
 void
 run_fades(Display *dpy) {
-  int now = get_time_in_milliseconds();
+  long now;
   fade *next = fades;
-  int steps;
   Bool need_dequeue;
 
-#if 0
-  printf("run fades\n");
-#endif
-
-  if (fade_time - now > 0) return;
-  steps = 1 + (now - fade_time) / fade_delta;
+  if (!fades) return;
+  now = get_time_in_microseconds();
+  if (fade_deadline - now > 0) return;
 
   while (next) {
     fade *f = next;
     win *w = f->w;
+    long elapsed = now - f->start_time;
     next = f->next;
 
-    f->cur += f->step * steps;
-    if (f->cur >= 1) {
-      f->cur = 1;
-    } else if (f->cur < 0) {
-      f->cur = 0;
+    if (elapsed < 0) elapsed = 0;
+    if (elapsed >= f->duration) {
+      f->cur = f->finish;
+      need_dequeue = True;
+    } else {
+      f->cur = f->start + (f->finish - f->start) * elapsed / f->duration;
+      need_dequeue = False;
     }
 
-#if 0
-    printf("opacity now %g\n", f->cur);
-#endif
-
     w->opacity = f->cur * OPAQUE;
-    need_dequeue = False;
-    if (f->step > 0) {
-      if (f->cur >= f->finish) {
-        w->opacity = f->finish * OPAQUE;
-        need_dequeue = True;
-      }
-    } else {
-      if (f->cur <= f->finish) {
-        w->opacity = f->finish * OPAQUE;
-        need_dequeue = True;
-      }
-    }
 
     determine_mode(dpy, w);
 
@@ -324,47 +348,7 @@ run_fades(Display *dpy) {
     if (need_dequeue) dequeue_fade(dpy, f);
   }
 
-  fade_time = now + fade_delta;
-}
-
-static double
-gaussian(double r, double x, double y) {
-  return ((1 / (sqrt(2 * M_PI * r))) *
-      exp((- (x * x + y * y)) / (2 * r * r)));
-}
-
-
-static conv *
-make_gaussian_map(Display *dpy, double r) {
-  conv *c;
-  int size = ((int) ceil((r * 3)) + 1) & ~1;
-  int center = size / 2;
-  int x, y;
-  double t;
-  double g;
-
-  c = malloc(sizeof(conv) + size * size * sizeof(double));
-  c->size = size;
-  c->data = (double *) (c + 1);
-  t = 0.0;
-
-  for (y = 0; y < size; y++) {
-    for (x = 0; x < size; x++) {
-      g = gaussian(r, (double) (x - center), (double) (y - center));
-      t += g;
-      c->data[y * size + x] = g;
-    }
-  }
-
-/*  printf("gaussian total %f\n", t); */
-
-  for (y = 0; y < size; y++) {
-    for (x = 0; x < size; x++) {
-      c->data[y * size + x] /= t;
-    }
-  }
-
-  return c;
+  fade_deadline = now + fade_tick();
 }
 
 /*
@@ -384,62 +368,13 @@ make_gaussian_map(Display *dpy, double r) {
  *  center  +-----+-------------------+-----+
  */
 
-static unsigned char
-sum_gaussian(conv *map, double opacity,
-             int x, int y, int width, int height) {
-  int fx, fy;
-  double *g_data;
-  double *g_line = map->data;
-  int g_size = map->size;
-  int center = g_size / 2;
-  int fx_start, fx_end;
-  int fy_start, fy_end;
-  double v;
-
-  /*
-   * Compute set of filter values which are "in range",
-   * that's the set with:
-   *    0 <= x + (fx-center) && x + (fx-center) < width &&
-   *  0 <= y + (fy-center) && y + (fy-center) < height
-   *
-   *  0 <= x + (fx - center)    x + fx - center < width
-   *  center - x <= fx    fx < width + center - x
-   */
-
-  fx_start = center - x;
-  if (fx_start < 0) fx_start = 0;
-  fx_end = width + center - x;
-  if (fx_end > g_size) fx_end = g_size;
-
-  fy_start = center - y;
-  if (fy_start < 0) fy_start = 0;
-  fy_end = height + center - y;
-  if (fy_end > g_size) fy_end = g_size;
-
-  g_line = g_line + fy_start * g_size + fx_start;
-
-  v = 0;
-
-  for (fy = fy_start; fy < fy_end; fy++) {
-    g_data = g_line;
-    g_line += g_size;
-
-    for (fx = fx_start; fx < fx_end; fx++) {
-      v += *g_data++;
-    }
-  }
-
-  if (v > 1) v = 1;
-
-  return ((unsigned char) (v * opacity * 255.0));
-}
-
 /* precompute shadow corners and sides
    to save time for large windows */
 static void
-presum_gaussian(conv *map) {
+presum_gaussian(GaussMap *map) {
   int center = map->size/2;
   int opacity, x, y;
+  unsigned char *top, *corner;
 
   Gsize = map->size;
 
@@ -449,36 +384,31 @@ presum_gaussian(conv *map) {
   shadow_corner = (unsigned char *)(malloc((Gsize + 1) * (Gsize + 1) * 26));
   shadow_top = (unsigned char *)(malloc((Gsize + 1) * 26));
 
-  for (x = 0; x <= Gsize; x++) {
-    shadow_top[25 * (Gsize + 1) + x] =
-      sum_gaussian(map, 1, x - center, center, Gsize * 2, Gsize * 2);
-
-    for (opacity = 0; opacity < 25; opacity++) {
-      shadow_top[opacity * (Gsize + 1) + x] =
-        shadow_top[25 * (Gsize + 1) + x] * opacity / 25;
+  top = &shadow_top[25 * (Gsize + 1)];
+  corner = &shadow_corner[25 * (Gsize + 1) * (Gsize + 1)];
+  gauss_fill(map, 1, Gsize * 2, Gsize * 2,
+             -center, center, Gsize + 1 - center, center + 1, top, Gsize + 1);
+  gauss_fill(map, 1, Gsize * 2, Gsize * 2,
+             -center, -center, Gsize + 1 - center, Gsize + 1 - center,
+             corner, Gsize + 1);
+
+  for (opacity = 0; opacity < 25; opacity++) {
+    for (x = 0; x <= Gsize; x++) {
+      shadow_top[opacity * (Gsize + 1) + x] = top[x] * opacity / 25;
     }
-
-    for (y = 0; y <= x; y++) {
-      shadow_corner[25 * (Gsize + 1) * (Gsize + 1) + y * (Gsize + 1) + x]
-        = sum_gaussian(map, 1, x - center, y - center, Gsize * 2, Gsize * 2);
-      shadow_corner[25 * (Gsize + 1) * (Gsize + 1) + x * (Gsize + 1) + y]
-        = shadow_corner[25 * (Gsize + 1) * (Gsize + 1) + y * (Gsize + 1) + x];
-
-      for (opacity = 0; opacity < 25; opacity++) {
-        shadow_corner[opacity * (Gsize + 1) * (Gsize + 1)
-                      + y * (Gsize + 1) + x]
-          = shadow_corner[opacity * (Gsize + 1) * (Gsize + 1)
-                          + x * (Gsize + 1) + y]
-          = shadow_corner[25 * (Gsize + 1) * (Gsize + 1)
-                          + y * (Gsize + 1) + x] * opacity / 25;
+    for (y = 0; y <= Gsize; y++) {
+      for (x = 0; x <= Gsize; x++) {
+        shadow_corner[opacity * (Gsize + 1) * (Gsize + 1) + y * (Gsize + 1) + x]
+          = corner[y * (Gsize + 1) + x] * opacity / 25;
       }
     }
   }
 }
 
-/// Make that part of the shadow transparent that is immediately below its window
-static void make_transparent_shadowcenter(int width, int height, int swidth, int sheight,
-                                          unsigned char *data){
+/// Get that part of the shadow that is immediately below its window. Returns false,
+/// if it is empty.
+static bool shadow_center_rect(int width, int height, int swidth, int sheight,
+                               XRectangle *r){
   int ylimit;
   int x, y;
   int x_diff;
@@ -507,13 +437,29 @@ static void make_transparent_shadowcenter(int width, int height, int swidth, int
     ylimit = height - shadow_offset_y;
   }
 
-  if(likely(x_diff > 0)){
-    assert(y >=0);
-    assert(ylimit <= sheight);
-    assert(x >=0 && x < swidth);
-    assert(x+x_diff <= swidth);
-    for(; y < ylimit ; y++){
-      memset(&data[y * swidth + x], 0, x_diff);
+  if(unlikely(x_diff <= 0 || ylimit <= y)){
+    return false;
+  }
+  assert(y >=0);
+  assert(ylimit <= sheight);
+  assert(x >=0 && x < swidth);
+  assert(x+x_diff <= swidth);
+  r->x = x;
+  r->y = y;
+  r->width = x_diff;
+  r->height = ylimit - y;
+  return true;
+}
+
+/// Make that part of the shadow transparent that is immediately below its window
+static void make_transparent_shadowcenter(int width, int height, int swidth, int sheight,
+                                          unsigned char *data){
+  XRectangle r;
+  int y;
+
+  if(likely(shadow_center_rect(width, height, swidth, sheight, &r))){
+    for(y = r.y; y < r.y + r.height; y++){
+      memset(&data[y * swidth + r.x], 0, r.width);
     }
   }
 }
@@ -557,7 +503,7 @@ make_shadow(Display *dpy, double opacity,
   if (Gsize > 0) {
     d = shadow_top[opacity_int * (Gsize + 1) + Gsize];
   } else {
-    d = sum_gaussian(gaussian_map,
+    d = gauss_sum(gaussian_map,
       opacity, center, center, width, height);
   }
 
@@ -573,16 +519,19 @@ make_shadow(Display *dpy, double opacity,
   xlimit = gsize;
   if (xlimit > swidth / 2) xlimit = (swidth + 1) / 2;
 
+  if (xlimit == Gsize && ylimit == Gsize) {
+    for (y = 0; y < ylimit; y++) {
+      memcpy(&data[y * swidth],
+             &shadow_corner[opacity_int * (Gsize + 1) * (Gsize + 1) + y * (Gsize + 1)],
+             xlimit);
+    }
+  } else {
+    gauss_fill(gaussian_map, opacity, width, height,
+               -center, -center, xlimit - center, ylimit - center, data, swidth);
+  }
   for (y = 0; y < ylimit; y++)
     for (x = 0; x < xlimit; x++) {
-      if (xlimit == Gsize && ylimit == Gsize) {
-        d = shadow_corner[opacity_int * (Gsize + 1) * (Gsize + 1)
-                          + y * (Gsize + 1) + x];
-      } else {
-        d = sum_gaussian(gaussian_map,
-          opacity, x - center, y - center, width, height);
-      }
-      data[y * swidth + x] = d;
+      d = data[y * swidth + x];
       data[(sheight - y - 1) * swidth + x] = d;
       data[(sheight - y - 1) * swidth + (swidth - x - 1)] = d;
       data[y * swidth + (swidth - x - 1)] = d;
@@ -598,7 +547,7 @@ make_shadow(Display *dpy, double opacity,
       if (ylimit == Gsize) {
         d = shadow_top[opacity_int * (Gsize + 1) + y];
       } else {
-        d = sum_gaussian(gaussian_map,
+        d = gauss_sum(gaussian_map,
           opacity, center, y - center, width, height);
       }
       memset(&data[y * swidth + gsize], d, x_diff);
@@ -614,7 +563,7 @@ make_shadow(Display *dpy, double opacity,
     if (xlimit == Gsize) {
       d = shadow_top[opacity_int * (Gsize + 1) + x];
     } else {
-      d = sum_gaussian(gaussian_map,
+      d = gauss_sum(gaussian_map,
         opacity, x - center, center, width, height);
     }
     for (y = gsize; y < sheight - gsize; y++) {
@@ -633,6 +582,181 @@ make_shadow(Display *dpy, double opacity,
   return ximage;
 }
 
+/*
+ * Nine-slice shadow tiles. For windows of at least Gsize x Gsize, make_shadow only
+ * uses the presummed corner and edge values, which depend on the (quantized)
+ * opacity alone. So per opacity we keep a Gsize x Gsize corner, a 1 x Gsize
+ * column for top/bottom, a Gsize x 1 row for left/right and a 1x1 center on the
+ * server. Mirrored corners and edges are pictures of the same pixmap with a
+ * flipping transform, edges and center repeat. A window's shadow is then
+ * assembled on the server, which keeps resizing free of CPU rasterization and
+ * big uploads. There are at most 26 opacity levels, which bounds the memory.
+ */
+#define SHADOW_OPACITY_LEVELS 26
+
+enum { TILE_TL, TILE_TR, TILE_BL, TILE_BR };
+enum { TILE_TOP, TILE_BOTTOM, TILE_LEFT, TILE_RIGHT };
+
+typedef struct {
+  Picture corner[4];
+  Picture edge[4];
+  Picture center;
+} ShadowTiles;
+
+static ShadowTiles shadow_tiles[SHADOW_OPACITY_LEVELS];
+
+static Pixmap
+upload_a8(Display *dpy, unsigned char *data, int width, int height) {
+  XImage *image;
+  Pixmap pixmap;
+  GC gc;
+
+  image = XCreateImage(
+    dpy, DefaultVisual(dpy, DefaultScreen(dpy)), 8,
+    ZPixmap, 0, (char *) data, width, height, 8, width);
+  if (!image) return None;
+
+  pixmap = XCreatePixmap(dpy, root, width, height, 8);
+  gc = XCreateGC(dpy, pixmap, 0, 0);
+  XPutImage(dpy, pixmap, gc, image, 0, 0, 0, 0, width, height);
+  XFreeGC(dpy, gc);
+  image->data = NULL; // owned by the caller
+  XDestroyImage(image);
+  return pixmap;
+}
+
+static Picture
+tile_picture(Display *dpy, Pixmap pixmap, int width, int height,
+             bool hflip, bool vflip, bool repeat) {
+  XRenderPictureAttributes pa;
+  Picture picture;
+
+  pa.repeat = repeat;
+  picture = XRenderCreatePicture(dpy, pixmap,
+    XRenderFindStandardFormat(dpy, PictStandardA8), CPRepeat, &pa);
+  if (hflip || vflip) {
+    // maps destination to source coordinates: x' = width - x, y' = height - y
+    XTransform t = {{
+      { XDoubleToFixed(hflip ? -1 : 1), 0, XDoubleToFixed(hflip ? width : 0) },
+      { 0, XDoubleToFixed(vflip ? -1 : 1), XDoubleToFixed(vflip ? height : 0) },
+      { 0, 0, XDoubleToFixed(1) }
+    }};
+    XRenderSetPictureTransform(dpy, picture, &t);
+  }
+  return picture;
+}
+
+static ShadowTiles *
+get_shadow_tiles(Display *dpy, int opacity_int) {
+  ShadowTiles *tiles = &shadow_tiles[opacity_int];
+  unsigned char *corner, *edge;
+  Pixmap pixmap;
+  int x, y;
+
+  if (tiles->center) return tiles;
+
+  corner = malloc(Gsize * Gsize);
+  edge = malloc(Gsize);
+  if (!corner || !edge) {
+    free(corner);
+    free(edge);
+    return NULL;
+  }
+  for (y = 0; y < Gsize; y++) {
+    for (x = 0; x < Gsize; x++) {
+      corner[y * Gsize + x] = shadow_corner[opacity_int * (Gsize + 1) * (Gsize + 1)
+                                            + y * (Gsize + 1) + x];
+    }
+    edge[y] = shadow_top[opacity_int * (Gsize + 1) + y];
+  }
+
+  pixmap = upload_a8(dpy, corner, Gsize, Gsize);
+  tiles->corner[TILE_TL] = tile_picture(dpy, pixmap, Gsize, Gsize, false, false, false);
+  tiles->corner[TILE_TR] = tile_picture(dpy, pixmap, Gsize, Gsize, true, false, false);
+  tiles->corner[TILE_BL] = tile_picture(dpy, pixmap, Gsize, Gsize, false, true, false);
+  tiles->corner[TILE_BR] = tile_picture(dpy, pixmap, Gsize, Gsize, true, true, false);
+  XFreePixmap(dpy, pixmap);
+
+  pixmap = upload_a8(dpy, edge, 1, Gsize);
+  tiles->edge[TILE_TOP] = tile_picture(dpy, pixmap, 1, Gsize, false, false, true);
+  tiles->edge[TILE_BOTTOM] = tile_picture(dpy, pixmap, 1, Gsize, false, true, true);
+  XFreePixmap(dpy, pixmap);
+
+  pixmap = upload_a8(dpy, edge, Gsize, 1);
+  tiles->edge[TILE_LEFT] = tile_picture(dpy, pixmap, Gsize, 1, false, false, true);
+  tiles->edge[TILE_RIGHT] = tile_picture(dpy, pixmap, Gsize, 1, true, false, true);
+  XFreePixmap(dpy, pixmap);
+
+  edge[0] = shadow_top[opacity_int * (Gsize + 1) + Gsize];
+  pixmap = upload_a8(dpy, edge, 1, 1);
+  tiles->center = tile_picture(dpy, pixmap, 1, 1, false, false, true);
+  XFreePixmap(dpy, pixmap);
+
+  free(corner);
+  free(edge);
+  g_stats.shadow_tile_bytes += Gsize * Gsize + 2 * Gsize + 1;
+  return tiles;
+}
+
+/// Assemble the shadow of a window of at least Gsize x Gsize from the cached tiles.
+static Picture
+tiled_shadow_picture(Display *dpy, double opacity, shadowtype shadow_type,
+                     int width, int height, int *wp, int *hp) {
+  ShadowTiles *tiles = get_shadow_tiles(dpy, (int)(opacity * 25));
+  int swidth = width + Gsize;
+  int sheight = height + Gsize;
+  int g = Gsize;
+  Pixmap pixmap;
+  Picture picture;
+  XRectangle r;
+
+  if (!tiles) return None;
+
+  pixmap = XCreatePixmap(dpy, root, swidth, sheight, 8);
+  if (!pixmap) return None;
+  picture = XRenderCreatePicture(dpy, pixmap,
+    XRenderFindStandardFormat(dpy, PictStandardA8), 0, 0);
+  XFreePixmap(dpy, pixmap);
+  if (!picture) return None;
+
+  XRenderComposite(dpy, PictOpSrc, tiles->corner[TILE_TL], None, picture,
+                   0, 0, 0, 0, 0, 0, g, g);
+  XRenderComposite(dpy, PictOpSrc, tiles->corner[TILE_TR], None, picture,
+                   0, 0, 0, 0, swidth - g, 0, g, g);
+  XRenderComposite(dpy, PictOpSrc, tiles->corner[TILE_BL], None, picture,
+                   0, 0, 0, 0, 0, sheight - g, g, g);
+  XRenderComposite(dpy, PictOpSrc, tiles->corner[TILE_BR], None, picture,
+                   0, 0, 0, 0, swidth - g, sheight - g, g, g);
+  if (swidth > 2 * g) {
+    XRenderComposite(dpy, PictOpSrc, tiles->edge[TILE_TOP], None, picture,
+                     0, 0, 0, 0, g, 0, swidth - 2 * g, g);
+    XRenderComposite(dpy, PictOpSrc, tiles->edge[TILE_BOTTOM], None, picture,
+                     0, 0, 0, 0, g, sheight - g, swidth - 2 * g, g);
+  }
+  if (sheight > 2 * g) {
+    XRenderComposite(dpy, PictOpSrc, tiles->edge[TILE_LEFT], None, picture,
+                     0, 0, 0, 0, 0, g, g, sheight - 2 * g);
+    XRenderComposite(dpy, PictOpSrc, tiles->edge[TILE_RIGHT], None, picture,
+                     0, 0, 0, 0, swidth - g, g, g, sheight - 2 * g);
+  }
+  if (swidth > 2 * g && sheight > 2 * g) {
+    XRenderComposite(dpy, PictOpSrc, tiles->center, None, picture,
+                     0, 0, 0, 0, g, g, swidth - 2 * g, sheight - 2 * g);
+  }
+
+  if (shadow_type == SHADOW_NOCENTER &&
+      shadow_center_rect(width, height, swidth, sheight, &r)) {
+    XRenderColor transparent = { 0 };
+    XRenderFillRectangle(dpy, PictOpSrc, picture, &transparent,
+                         r.x, r.y, r.width, r.height);
+  }
+
+  g_stats.shadow_builds_tiled++;
+  *wp = swidth;
+  *hp = sheight;
+  return picture;
+}
+
 static Picture
 shadow_picture(Display *dpy, double opacity, shadowtype shadow_type,
                int width, int height, int *wp, int *hp) {
@@ -641,6 +765,13 @@ shadow_picture(Display *dpy, double opacity, shadowtype shadow_type,
   Picture shadow_picture;
   GC gc;
 
+  if (likely(Gsize > 0 && width >= Gsize && height >= Gsize)) {
+    shadow_picture = tiled_shadow_picture(dpy, opacity, shadow_type,
+                                          width, height, wp, hp);
+    if (likely(shadow_picture)) return shadow_picture;
+  }
+  g_stats.shadow_builds_cpu++;
+
   shadowImage = make_shadow(dpy, opacity, width, height, shadow_type);
   if (!shadowImage) return None;
 
@@ -716,17 +847,94 @@ solid_picture(Display *dpy, Bool argb, double a,
   return picture;
 }
 
+/// Alpha masks for translucent windows and frames, shared by all windows with
+/// the same opacity. They are A8, so quantizing the opacity to 256 levels
+/// does not change the result. Unreferenced masks are kept (up to
+/// ALPHA_PICTS_MAX_IDLE, the least recently used is freed first), so focus
+/// changes under inactive_opacity do not create and destroy them over and over.
+#define ALPHA_LEVELS 256
+#define ALPHA_PICTS_MAX_IDLE 16
+
+typedef struct {
+  Picture pict;
+  int refs;
+  short idle_prev, idle_next; // the list of unreferenced masks, -1 ends it
+} AlphaPict;
+
+static AlphaPict alpha_picts[ALPHA_LEVELS];
+static int alpha_picts_idle = 0;
+static int alpha_idle_oldest = -1, alpha_idle_newest = -1;
 
 static void
-paint_root(Display *dpy) {
+alpha_idle_unlink(int level) {
+  AlphaPict *ap = &alpha_picts[level];
+
+  if (ap->idle_prev >= 0) alpha_picts[ap->idle_prev].idle_next = ap->idle_next;
+  else alpha_idle_oldest = ap->idle_next;
+  if (ap->idle_next >= 0) alpha_picts[ap->idle_next].idle_prev = ap->idle_prev;
+  else alpha_idle_newest = ap->idle_prev;
+  alpha_picts_idle--;
+}
+
+/// The mask for opacity, its level is stored in *level for release_alpha_pict.
+static Picture
+get_alpha_pict(Display *dpy, double opacity, unsigned char *level) {
+  int l = (int)(opacity * (ALPHA_LEVELS - 1) + 0.5);
+  AlphaPict *ap;
+
+  if (l < 0) l = 0;
+  if (l > ALPHA_LEVELS - 1) l = ALPHA_LEVELS - 1;
+  ap = &alpha_picts[l];
+
+  if (!ap->pict) {
+    ap->pict = solid_picture(
+      dpy, False, (double)l / (ALPHA_LEVELS - 1), 0, 0, 0);
+    if (!ap->pict) return None;
+  } else if (ap->refs == 0) {
+    alpha_idle_unlink(l);
+  }
+  ap->refs++;
+  *level = l;
+  return ap->pict;
+}
+
+static void
+release_alpha_pict(Display *dpy, Picture *pict, int level) {
+  AlphaPict *ap = &alpha_picts[level];
+
+  if (!*pict) return;
+  *pict = None;
+  if (--ap->refs > 0) return;
+
+  ap->idle_prev = alpha_idle_newest;
+  ap->idle_next = -1;
+  if (alpha_idle_newest >= 0) alpha_picts[alpha_idle_newest].idle_next = level;
+  else alpha_idle_oldest = level;
+  alpha_idle_newest = level;
+  if (++alpha_picts_idle > ALPHA_PICTS_MAX_IDLE) {
+    int oldest = alpha_idle_oldest;
+    alpha_idle_unlink(oldest);
+    XRenderFreePicture(dpy, alpha_picts[oldest].pict);
+    alpha_picts[oldest].pict = None;
+  }
+}
+
+
+/// Paint the background into region, the damage not covered by opaque windows.
+/// root_buffer must be clipped to it.
+static void
+paint_root(Display *dpy, const CompRegion *region) {
+  CompBox b;
+
+  if (!comp_region_extents(region, &b)) return;
   if (!root_tile) {
     root_tile = root_create_tile();
   }
 
   XRenderComposite(
     dpy, PictOpSrc, root_tile, None,
-    root_buffer, 0, 0, 0, 0, 0, 0,
-    root_width, root_height);
+    root_buffer, b.x1, b.y1, 0, 0, b.x1, b.y1,
+    b.x2 - b.x1, b.y2 - b.y1);
 }
 
 static shadowtype shadow_find_type(win *w){
@@ -770,7 +978,7 @@ static bool shadow_should_render(shadowtype t){
   return false;
 }
 
-static XserverRegion
+static void
 win_extents(Display *dpy, win *w) {
   XRectangle r;
 
@@ -830,38 +1038,68 @@ win_extents(Display *dpy, win *w) {
       r.height = sr.y + sr.height - r.y;
     }
   }
-  if(! w->extents){
-    w->extents = XFixesCreateRegion(dpy, &r, 1);
-  } else {
-    XFixesSetRegion(dpy, w->extents, &r, 1);
-  }
-  return w->extents;
+  w->extents_rect = r;
+  w->has_extents = true;
+}
 
+static inline CompRect
+comp_rect_of(const XRectangle *r) {
+  CompRect c = { .x1 = r->x, .y1 = r->y,
+                 .x2 = r->x + r->width, .y2 = r->y + r->height,
+                 .w = r->width, .h = r->height };
+  return c;
 }
 
-static XserverRegion
-border_size(Display *dpy, win *w) {
-  XserverRegion border;
+/// Find out, whether w is shaped and keep its bounding region, if so. That
+/// costs a round-trip, so it is done once per window and again only after a
+/// ShapeNotify or a resize.
+static void
+win_fetch_shape(Display *dpy, win *w) {
+  XRectangle *rects;
+  int n = 0, ordering;
 
-  /*
-   * if window doesn't exist anymore,  this will generate an error
-   * as well as not generate a region.  Perhaps a better XFixes
-   * architecture would be to have a request that copies instead
-   * of creates, that way you'd just end up with an empty region
-   * instead of an invalid XID.
-   */
+  w->shaped_type = SHAPED_NO;
+  comp_region_clear(&w->shape);
+  if (!has_shape) return;
 
+  // if the window doesn't exist anymore, this fails: treat it as unshaped
   set_ignore(dpy, NextRequest(dpy));
-  border = XFixesCreateRegionFromWindow(
-    dpy, w->id, WindowRegionBounding);
+  rects = XShapeGetRectangles(dpy, w->id, ShapeBounding, &n, &ordering);
+  if (!rects) return;
+
+  // The default bounding region is the window including its border.
+  if (n != 1 || rects[0].x != -w->a.border_width ||
+      rects[0].y != -w->a.border_width ||
+      rects[0].width != w->a.width + w->a.border_width * 2 ||
+      rects[0].height != w->a.height + w->a.border_width * 2) {
+    w->shaped_type = SHAPED_YES;
+    for (int i = 0; i < n; i++) {
+      CompRect r = comp_rect_of(&rects[i]);
+      comp_region_union_rect(&w->shape, &r);
+    }
+  }
+  XFree(rects);
+}
 
-  /* translate this */
-  set_ignore(dpy, NextRequest(dpy));
-  XFixesTranslateRegion(dpy, border,
-    w->a.x + w->a.border_width,
-    w->a.y + w->a.border_width);
+/// Set w->border_size to the bounding region of w in root coordinates.
+static void
+border_size(Display *dpy, win *w) {
+  int x = w->a.x + w->a.border_width;
+  int y = w->a.y + w->a.border_width;
 
-  return border;
+  if (unlikely(w->shaped_type == SHAPED_UNKNOWN)) {
+    win_fetch_shape(dpy, w);
+  }
+  if (unlikely(w->shaped_type == SHAPED_YES)) {
+    comp_region_copy(&w->border_size, &w->shape);
+    comp_region_translate(&w->border_size, x, y);
+  } else {
+    CompBox b = { .x1 = w->a.x, .y1 = w->a.y,
+                  .x2 = x + w->a.width + w->a.border_width,
+                  .y2 = y + w->a.height + w->a.border_width };
+    comp_region_set_box(&w->border_size, &b);
+  }
+  w->border_size_valid = true;
 }
 
 static Window
@@ -955,7 +1193,7 @@ get_frame_extents(win* w,
 }
 
 static Bool
-win_paint_needed(win* w, CompRect* ignore_reg){
+win_paint_needed(win* w, CompRegion* ignore_reg){
   // if invisible, ignore it
     if (unlikely(w->a.x + w->a.width < 1 || w->a.y + w->a.height < 1
         || w->a.x >= root_width || w->a.y >= root_height)) {
@@ -987,27 +1225,130 @@ win_paint_needed(win* w, CompRect* ignore_reg){
     case HIDDEN_IGNORE: break;
     }
 
+    // Only the on-screen part of a window matters for occlusion.
+    CompRect w_rect = {.x1 = w->a.x, .y1 = w->a.y,
+                   .x2 = w->a.x + w->a.width, .y2 = w->a.y + w->a.height };
+    if (w_rect.x1 < 0) w_rect.x1 = 0;
+    if (w_rect.y1 < 0) w_rect.y1 = 0;
+    if (w_rect.x2 > root_width) w_rect.x2 = root_width;
+    if (w_rect.y2 > root_height) w_rect.y2 = root_height;
+    w_rect.w = w_rect.x2 - w_rect.x1;
+    w_rect.h = w_rect.y2 - w_rect.y1;
+
+    g_stats.occlusion_tests++;
     // Unmapped, destroyed or translucent windows must not contribute to the ignore region.
     // Same applies to override_redirect windows, which some screenshooter apps employ
     // (s. e.g. xfce4-screenshooter
     // screenshooter-capture.c::get_rectangle_screenshot_composited )
+    // They can be occluded themselves, though.
     if (w->a.map_state != IsViewable || w->destroyed || w->opacity != OPAQUE ||
         w->a.override_redirect){
+      if(comp_region_contains_rect(ignore_reg, &w_rect)){
+        g_stats.occlusion_culled++;
+        return False;
+      }
       return True;
     }
-    CompRect w_rect = {.x1 = w->a.x, .y1 = w->a.y,
-                   .x2 = w->a.x + w->a.width, .y2 = w->a.y + w->a.height,
-                   .w = w->a.width , .h = w->a.height };
-    return rect_paint_needed(ignore_reg, &w_rect);
+    if(!rect_paint_needed(ignore_reg, &w_rect)){
+      g_stats.occlusion_culled++;
+      return False;
+    }
+    return True;
+}
+
+/// Clip a to b (to an empty rectangle, if they do not intersect).
+static void
+rect_intersect(XRectangle *a, const XRectangle *b) {
+  int x1 = a->x, y1 = a->y, x2 = a->x + a->width, y2 = a->y + a->height;
+
+  if (b->x > x1) x1 = b->x;
+  if (b->y > y1) y1 = b->y;
+  if (b->x + b->width < x2) x2 = b->x + b->width;
+  if (b->y + b->height < y2) y2 = b->y + b->height;
+  a->x = x1;
+  a->y = y1;
+  a->width = (x2 > x1) ? x2 - x1 : 0;
+  a->height = (y2 > y1) ? y2 - y1 : 0;
+}
+
+/// While a window is being resized, its pixmap changes with every step, so its
+/// picture is made of the window itself, which stays valid (s. paint_all).
+static inline bool
+win_resizing(win *w) {
+  // no size change for this long ends a resize
+  const int RESIZE_SETTLE_MILISEC = 250;
+  return w->resize_time &&
+         get_time_in_milliseconds() - w->resize_time < RESIZE_SETTLE_MILISEC;
+}
+
+/// Where w->picture goes: a named pixmap includes the border, the window does not.
+static void
+win_picture_rect(win *w, int *x, int *y, int *wid, int *hei) {
+#if HAS_NAME_WINDOW_PIXMAP
+  if (w->pixmap) {
+    *x = w->a.x;
+    *y = w->a.y;
+    *wid = w->a.width + w->a.border_width * 2;
+    *hei = w->a.height + w->a.border_width * 2;
+    return;
+  }
+#endif
+  *x = w->a.x + w->a.border_width;
+  *y = w->a.y + w->a.border_width;
+  *wid = w->a.width;
+  *hei = w->a.height;
 }
 
+/// Set the clip of pict to the client side region reg.
 static void
-paint_all(Display *dpy, XserverRegion region) {
+set_picture_clip(Display *dpy, Picture pict, const CompRegion *reg) {
+  static XRectangle *rects = NULL;
+  static int cap = 0;
+  int n = reg->n;
+
+  if (unlikely(n > cap)) {
+    XRectangle *r = realloc(rects, n * sizeof(XRectangle));
+    if (unlikely(!r)) {
+      // clip to the bounding box instead
+      CompBox b;
+      XRectangle ext;
+      comp_region_extents(reg, &b);
+      ext.x = b.x1;
+      ext.y = b.y1;
+      ext.width = b.x2 - b.x1;
+      ext.height = b.y2 - b.y1;
+      XRenderSetPictureClipRectangles(dpy, pict, 0, 0, &ext, 1);
+      return;
+    }
+    rects = r;
+    cap = n;
+  }
+  for (int i = 0; i < n; i++) {
+    const CompBox *b = &reg->boxes[i];
+    rects[i].x = b->x1;
+    rects[i].y = b->y1;
+    rects[i].width = b->x2 - b->x1;
+    rects[i].height = b->y2 - b->y1;
+  }
+  XRenderSetPictureClipRectangles(dpy, pict, 0, 0, rects, n);
+}
+
+/// Paint the damaged region, which is clobbered.
+static void
+paint_all(Display *dpy, CompRegion *region) {
   win *w;
   win *t = 0;
   Bool ignore_region_is_dirty = g_paint_ignore_region_is_dirty;
+  CompBox ext;
+  XRectangle blit;
   g_paint_ignore_region_is_dirty = False;
 
+  comp_region_extents(region, &ext);
+  blit.x = ext.x1;
+  blit.y = ext.y1;
+  blit.width = ext.x2 - ext.x1;
+  blit.height = ext.y2 - ext.y1;
+
 #if MONITOR_REPAINT
   root_buffer = root_picture;
 #else
@@ -1021,10 +1362,20 @@ paint_all(Display *dpy, XserverRegion region) {
       0, 0);
 
     XFreePixmap(dpy, rootPixmap);
+    root_buffer_age = 0;
+  }
+  if (unlikely(root_buffer_age == 0)) {
+    // Neither root_buffer nor the screen can be trusted outside the damage,
+    // paint and copy everything.
+    CompBox root_box = { .x1 = 0, .y1 = 0, .x2 = root_width, .y2 = root_height };
+    blit.x = blit.y = 0;
+    blit.width = root_width;
+    blit.height = root_height;
+    comp_region_set_box(region, &root_box);
   }
 #endif
 
-  XFixesSetPictureClipRegion(dpy, root_picture, 0, 0, region);
+  set_picture_clip(dpy, root_picture, region);
 
 #if MONITOR_REPAINT
   XRenderComposite(
@@ -1037,13 +1388,26 @@ paint_all(Display *dpy, XserverRegion region) {
   printf("paint:");
 #endif
 
-  CompRect ignore_reg = {0};
+  // the union of the opaque windows seen so far, front to back
+  static CompRegion ignore_reg;
+  // occlusion dirty windows yet to come (s. set_occlusion_dirty)
+  int occlusion_dirty = g_occlusion_dirty_count;
+  comp_region_clear(&ignore_reg);
+  g_occlusion_dirty_count = 0;
   for (w = list; w; w = w->next) {
     // Don't do this here, otherwise we get artifacts after move.
     // if (w->need_configure){
     //   do_configure_win(dpy, w);
     // }
 
+    // Restacking changes the occlusion of the windows down to the lowest
+    // dirty one, not below.
+    Bool occlusion_changed = occlusion_dirty > 0;
+    if (unlikely(w->occlusion_dirty)) {
+      w->occlusion_dirty = false;
+      occlusion_dirty--;
+    }
+
 #if CAN_DO_USABLE
     if (!w->usable) continue;
 #endif
@@ -1053,21 +1417,27 @@ paint_all(Display *dpy, XserverRegion region) {
 
     // Note that undamaged windows should not contribute to the ignore
     // region. Otherwise VBoxManager makes other windows disappear during startup.
-    if(unlikely(ignore_region_is_dirty || clip_changed)){
-      // maybe_todo: pass only clipped rects, actually visible on screen.
-      // Now we may choose the ignore region from a big window which
-      // resides largely outside the screen.
+    if(unlikely(ignore_region_is_dirty || clip_changed || occlusion_changed)){
       w->paint_needed = win_paint_needed(w, &ignore_reg);
     }
     if(!w->paint_needed) continue;
 
+#if HAS_NAME_WINDOW_PIXMAP
+    // the resize is over: back to a named pixmap, which survives destruction
+    if (unlikely(w->picture && !w->pixmap && has_name_pixmap &&
+                 !win_resizing(w))) {
+      XRenderFreePicture(dpy, w->picture);
+      w->picture = None;
+    }
+#endif
+
     if (!w->picture) {
       XRenderPictureAttributes pa;
       XRenderPictFormat *format;
       Drawable draw = w->id;
 
 #if HAS_NAME_WINDOW_PIXMAP
-      if (has_name_pixmap && !w->pixmap) {
+      if (has_name_pixmap && !w->pixmap && !win_resizing(w)) {
         set_ignore(dpy, NextRequest(dpy));
         w->pixmap = XCompositeNameWindowPixmap(dpy, w->id);
       }
@@ -1084,43 +1454,28 @@ paint_all(Display *dpy, XserverRegion region) {
     printf(" 0x%x", w->id);
 #endif
 
-    if (clip_changed) {
-      if (w->border_size) {
-        set_ignore(dpy, NextRequest(dpy));
-        XFixesDestroyRegion(dpy, w->border_size);
-        w->border_size = None;
-      }
+    if (unlikely(!w->has_extents)) {
       win_extents(dpy, w);
     }
 
-    if (!w->border_size) {
-      w->border_size = border_size (dpy, w);
+    // Neither w nor its shadow are damaged: nothing to paint, nor to clip.
+    {
+      XRectangle r = w->extents_rect;
+      rect_intersect(&r, &blit);
+      if (!r.width || !r.height) continue;
     }
 
-    if (unlikely(!w->extents)) {
-      win_extents(dpy, w);
+    if (!w->border_size_valid) {
+      border_size(dpy, w);
     }
 
     if (w->mode == WINDOW_SOLID && !HAS_FRAME_OPACITY(w)) {
       int x, y, wid, hei;
 
-#if HAS_NAME_WINDOW_PIXMAP
-      x = w->a.x;
-      y = w->a.y;
-      wid = w->a.width + w->a.border_width * 2;
-      hei = w->a.height + w->a.border_width * 2;
-#else
-      x = w->a.x + w->a.border_width;
-      y = w->a.y + w->a.border_width;
-      wid = w->a.width;
-      hei = w->a.height;
-#endif
+      win_picture_rect(w, &x, &y, &wid, &hei);
 
-      set_ignore(dpy, NextRequest(dpy));
-      XFixesSetPictureClipRegion(dpy, root_buffer, 0, 0, region);
-
-      set_ignore(dpy, NextRequest(dpy));
-      XFixesSubtractRegion(dpy, region, region, w->border_size);
+      set_picture_clip(dpy, root_buffer, region);
+      comp_region_op(region, region, &w->border_size, COMP_REGION_SUBTRACT);
 
       XRenderComposite(
         dpy, PictOpSrc, w->picture,
@@ -1128,7 +1483,7 @@ paint_all(Display *dpy, XserverRegion region) {
         x, y, wid, hei);
     }
 
-    XFixesCopyRegion(dpy, w->border_clip, region);
+    comp_region_copy(&w->border_clip, region);
 
     w->prev_trans = t;
     t = w;
@@ -1139,15 +1494,16 @@ paint_all(Display *dpy, XserverRegion region) {
   fflush(stdout);
 #endif
 
-  XFixesSetPictureClipRegion(dpy,
-    root_buffer, 0, 0, region);
-  paint_root(dpy);
+  // Nothing to do, where opaque windows cover the damage. Windows below set
+  // their own clips.
+  if (region->n) {
+    set_picture_clip(dpy, root_buffer, region);
+    paint_root(dpy, region);
+  }
 
   for (w = t; w; w = w->prev_trans) {
-    XFixesSetPictureClipRegion(dpy,
-      root_buffer, 0, 0, w->border_clip);
-
-    if(shadow_should_render(w->shadow_type)) {
+    if(shadow_should_render(w->shadow_type) && w->shadow) {
+      set_picture_clip(dpy, root_buffer, &w->border_clip);
       XRenderComposite(
         dpy, PictOpOver, cshadow_picture, w->shadow,
         root_buffer, 0, 0, 0, 0,
@@ -1156,12 +1512,12 @@ paint_all(Display *dpy, XserverRegion region) {
     }
 
     if (w->opacity != OPAQUE && !w->alpha_pict) {
-      w->alpha_pict = solid_picture(
-        dpy, False, (double)w->opacity / OPAQUE, 0, 0, 0);
+      w->alpha_pict = get_alpha_pict(dpy, (double)w->opacity / OPAQUE,
+                                    &w->alpha_level);
     }
     if (HAS_FRAME_OPACITY(w) && !w->alpha_border_pict) {
-      w->alpha_border_pict = solid_picture(
-        dpy, False, frame_opacity, 0, 0, 0);
+      w->alpha_border_pict = get_alpha_pict(dpy, frame_opacity,
+                                           &w->alpha_border_level);
     }
 
     if (w->mode != WINDOW_SOLID || HAS_FRAME_OPACITY(w)) {
@@ -1169,20 +1525,11 @@ paint_all(Display *dpy, XserverRegion region) {
       // 2024-11-26: Without the next two lines, the Microsoft-Teams screen-share
       // window has a broken frame instead of a shadow, with a "startup-frozen"
       // picture. Inspired by xcompmgr's commit 5a7d139f (2012-08-11).
-      XFixesIntersectRegion(dpy, w->border_clip, w->border_clip, w->border_size);
-      XFixesSetPictureClipRegion(dpy, root_buffer, 0, 0, w->border_clip);
+      comp_region_op(&w->border_clip, &w->border_clip, &w->border_size,
+                     COMP_REGION_INTERSECT);
+      set_picture_clip(dpy, root_buffer, &w->border_clip);
 
-#if HAS_NAME_WINDOW_PIXMAP
-      x = w->a.x;
-      y = w->a.y;
-      wid = w->a.width + w->a.border_width * 2;
-      hei = w->a.height + w->a.border_width * 2;
-#else
-      x = w->a.x + w->a.border_width;
-      y = w->a.y + w->a.border_width;
-      wid = w->a.width;
-      hei = w->a.height;
-#endif
+      win_picture_rect(w, &x, &y, &wid, &hei);
 
       set_ignore(dpy, NextRequest(dpy));
 
@@ -1226,24 +1573,81 @@ paint_all(Display *dpy, XserverRegion region) {
   }
 
 #if ! MONITOR_REPAINT
-    XFixesSetPictureClipRegion(dpy, root_buffer, 0, 0, None);
+    // root_picture is still clipped to the damage, root_buffer holds the
+    // previous frame elsewhere: copy only the damaged part.
+    {
+      XRenderPictureAttributes pa = { .clip_mask = None };
+      XRenderChangePicture(dpy, root_buffer, CPClipMask, &pa);
+    }
     XRenderComposite(
       dpy, PictOpSrc, root_buffer, None,
-      root_picture, 0, 0, 0, 0,
-      0, 0, root_width, root_height);
+      root_picture, blit.x, blit.y, 0, 0,
+      blit.x, blit.y, blit.width, blit.height);
+    if (root_buffer_age < INT_MAX) root_buffer_age++;
 #endif // ! MONITOR_REPAINT
 }
 
+/// Add the rectangle r to the damage of the monitors it intersects. Each monitor
+/// accumulates its damage until its next frame, all_damage_is_dirty tells,
+/// whether any monitor is damaged. The latency of the frame is measured from
+/// the earliest g_damage_origin of its damage.
 static void
-add_damage(Display *dpy, XserverRegion damage) {
-  if (all_damage_is_dirty) {
-    XFixesUnionRegion(dpy, all_damage, all_damage, damage);
-  } else {
-    XFixesCopyRegion(dpy, all_damage, damage);
+add_damage(const XRectangle *r) {
+  unsigned mask = monitors_mask(r);
+  for (int i = 0; i < num_monitors; i++) {
+    Monitor *m = &monitors[i];
+    XRectangle clipped = m->rect;
+    CompRect cr;
+    if (!(mask & (1u << i))) continue;
+    rect_intersect(&clipped, r);
+    cr = comp_rect_of(&clipped);
+    if (!m->damaged) {
+      comp_region_clear(&m->damage);
+      m->damaged = True;
+      m->damage_time = g_damage_origin;
+    } else if (g_damage_origin < m->damage_time) {
+      m->damage_time = g_damage_origin;
+    }
+    // repeated damage of the same area is common, e.g. a blinking cursor
+    if (!comp_region_contains_rect(&m->damage, &cr)) {
+      comp_region_union_rect(&m->damage, &cr);
+    }
     all_damage_is_dirty = True;
   }
 }
 
+/// The bounds of w's extents (s. win_extents), if it had the given geometry.
+/// The shadow is included, unless w is known not to have one.
+static void
+win_bounds(win *w, int x, int y, int width, int height, XRectangle *r) {
+  int x1 = x, y1 = y, x2 = x + width, y2 = y + height;
+
+  if (w->shadow_type == SHADOW_UNKNOWN || shadow_should_render(w->shadow_type)) {
+    int sx = x + shadow_offset_x;
+    int sy = y + shadow_offset_y;
+    if (sx < x1) x1 = sx;
+    if (sy < y1) y1 = sy;
+    if (sx + width + Gsize > x2) x2 = sx + width + Gsize;
+    if (sy + height + Gsize > y2) y2 = sy + height + Gsize;
+  }
+  r->x = x1;
+  r->y = y1;
+  r->width = x2 - x1;
+  r->height = y2 - y1;
+}
+
+static void
+win_current_bounds(win *w, XRectangle *r) {
+  win_bounds(w, w->a.x, w->a.y, w->a.width + w->a.border_width * 2,
+             w->a.height + w->a.border_width * 2, r);
+}
+
+/// Damage w's extents
+static void
+add_damage_win(Display *dpy, win *w) {
+  add_damage(&w->extents_rect);
+}
+
 
 static void
 add_damage_if_hidden_changed(Window window, bool is_reparent_event) {
@@ -1261,34 +1665,124 @@ add_damage_if_hidden_changed(Window window, bool is_reparent_event) {
     return;
   }
   w->hidden_type = hidden_type;
-  if(w->extents){
-    add_damage(dpy, w->extents);
+  if(w->has_extents){
+    add_damage_win(dpy, w);
   }
   clip_changed = True;
   set_paint_ignore_region_dirty();
 }
 
+/// Add the damage collected by queue_damage.
 static void
 repair_win(Display *dpy, win *w) {
-  XserverRegion parts;
-
   if (!w->damaged) {
-    parts = win_extents(dpy, w);
-    set_ignore(dpy, NextRequest(dpy));
-    XDamageSubtract(dpy, w->damage, None, None);
+    // the first damage: paint the whole window and its shadow
+    win_extents(dpy, w);
+    add_damage_win(dpy, w);
   } else {
-    parts = g_xregion_tmp;
-    set_ignore(dpy, NextRequest(dpy));
-    XDamageSubtract(dpy, w->damage, None, parts);
-    XFixesTranslateRegion(dpy, parts,
-      w->a.x + w->a.border_width,
-      w->a.y + w->a.border_width);
+    for (int i = 0; i < w->num_damage_rects; i++) {
+      XRectangle r = w->damage_rects[i];
+      r.x += w->a.x + w->a.border_width;
+      r.y += w->a.y + w->a.border_width;
+      add_damage(&r);
+    }
+    g_stats.damage_areas_added += w->num_damage_rects;
   }
-
-  add_damage(dpy, parts);
+  w->num_damage_rects = 0;
   w->damaged = 1;
 }
 
+static inline bool
+rect_contains(const XRectangle *a, const XRectangle *b) {
+  return a->x <= b->x && a->y <= b->y &&
+         a->x + a->width >= b->x + b->width &&
+         a->y + a->height >= b->y + b->height;
+}
+
+/// Collect the damage area (relative to w) reported by the server. A video or
+/// a browser may report hundreds of areas per frame, which are merged per
+/// window here and added to the damage only once per frame, s. flush_damage.
+static void
+queue_damage(win *w, const XRectangle *area) {
+  int n = w->num_damage_rects;
+
+  g_stats.damage_areas++;
+  if (!w->damage_rearm) {
+    w->damage_rearm = true;
+    g_damage_rearm_count++;
+  }
+  if (!w->damage_queued) {
+    w->damage_queued = true;
+    w->damage_time = g_damage_origin;
+    g_damage_queued_count++;
+  }
+  for (int i = 0; i < n; i++) {
+    if (rect_contains(&w->damage_rects[i], area)) return;
+    if (rect_contains(area, &w->damage_rects[i])) {
+      w->damage_rects[i] = *area;
+      return;
+    }
+  }
+  if (likely(n < WIN_DAMAGE_RECTS)) {
+    w->damage_rects[n] = *area;
+    w->num_damage_rects++;
+    return;
+  }
+  // too fragmented: damage the bounding box
+  int x1 = area->x, y1 = area->y;
+  int x2 = area->x + area->width, y2 = area->y + area->height;
+  for (int i = 0; i < n; i++) {
+    const XRectangle *r = &w->damage_rects[i];
+    if (r->x < x1) x1 = r->x;
+    if (r->y < y1) y1 = r->y;
+    if (r->x + r->width > x2) x2 = r->x + r->width;
+    if (r->y + r->height > y2) y2 = r->y + r->height;
+  }
+  w->damage_rects[0].x = x1;
+  w->damage_rects[0].y = y1;
+  w->damage_rects[0].width = x2 - x1;
+  w->damage_rects[0].height = y2 - y1;
+  w->num_damage_rects = 1;
+}
+
+/// Add the damage queued since the last call. Windows, which were unmapped
+/// meanwhile, are left alone.
+static void
+flush_damage(Display *dpy) {
+  long origin = g_damage_origin;
+  win *w;
+  for (w = list; w && g_damage_queued_count; w = w->next) {
+    if (!w->damage_queued) continue;
+    w->damage_queued = false;
+    g_damage_queued_count--;
+    if (w->a.map_state == IsViewable) {
+      g_damage_origin = w->damage_time;
+      repair_win(dpy, w);
+    } else {
+      w->num_damage_rects = 0;
+    }
+  }
+  g_damage_origin = origin;
+}
+
+/// The server reports only damage outside of the region of a damage object
+/// (XDamageReportDeltaRectangles), which we have to clear. Do so for the windows
+/// damaged since the last frame, ahead of painting them, so that nothing
+/// changing afterwards gets lost.
+static void
+rearm_damage(Display *dpy) {
+  win *w;
+  for (w = list; w && g_damage_rearm_count; w = w->next) {
+    if (!w->damage_rearm) continue;
+    w->damage_rearm = false;
+    g_damage_rearm_count--;
+    if (w->damage != None) {
+      set_ignore(dpy, NextRequest(dpy));
+      XDamageSubtract(dpy, w->damage, None, None);
+    }
+  }
+}
+
 #if 0
 static const char*
 wintype_name(wintype type) {
@@ -1422,18 +1916,11 @@ static void
 handle_ConfigureNotify(Display *dpy, XConfigureEvent *ce);
 
 static void
-map_win(Display *dpy, Window id,
-        unsigned long sequence, Bool fade) {
-  win *w = find_win(id);
-
-  if (unlikely(!w)) return;
+_map_win(Display *dpy, win *w, wintype type, Bool fade) {
+  Window id = w->id;
 
   w->a.map_state = IsViewable;
-  w->window_type = determine_wintype(dpy, w->id, w->id);
-
-  if (! w->border_clip) {
-    w->border_clip = XFixesCreateRegion(dpy, 0, 0);
-  }
+  w->window_type = type;
 
 #if 0
   printf("window 0x%x type %s\n",
@@ -1472,6 +1959,19 @@ map_win(Display *dpy, Window id,
   // }
 }
 
+static void
+map_win(Display *dpy, Window id,
+        unsigned long sequence, Bool fade) {
+  win *w = find_win(id);
+  WinInfo info;
+
+  if (unlikely(!w)) return;
+
+  wininfo_fetch(&id, 1, &info, 0, win_type);
+  _map_win(dpy, w, likely(info.complete) ? info.type :
+                   determine_wintype(dpy, id, id), fade);
+}
+
 static void
 finish_unmap_win(Display *dpy, win *w) {
   w->damaged = 0;
@@ -1479,8 +1979,8 @@ finish_unmap_win(Display *dpy, win *w) {
   w->usable = False;
 #endif
 
-  if (w->extents != None) {
-    add_damage(dpy, w->extents);
+  if (w->has_extents) {
+    add_damage_win(dpy, w);
   }
 
 #if HAS_NAME_WINDOW_PIXMAP
@@ -1496,16 +1996,15 @@ finish_unmap_win(Display *dpy, win *w) {
     w->picture = None;
   }
 
-  if (w->border_size) {
-    set_ignore(dpy, NextRequest(dpy));
-      XFixesDestroyRegion(dpy, w->border_size);
-      w->border_size = None;
-  }
+  comp_region_free(&w->border_size);
+  w->border_size_valid = false;
 
   if (w->shadow) {
     XRenderFreePicture(dpy, w->shadow);
     w->shadow = None;
   }
+  // computed again, with the shadow, once painted after the next map
+  w->has_extents = false;
 
   clip_changed = True;
 }
@@ -1603,15 +2102,8 @@ determine_mode(Display *dpy, win *w) {
 
   /* if trans prop == -1 fall back on  previous tests*/
 
-  if (w->alpha_pict) {
-    XRenderFreePicture(dpy, w->alpha_pict);
-    w->alpha_pict = None;
-  }
-
-  if (w->alpha_border_pict) {
-    XRenderFreePicture(dpy, w->alpha_border_pict);
-    w->alpha_border_pict = None;
-  }
+  release_alpha_pict(dpy, &w->alpha_pict, w->alpha_level);
+  release_alpha_pict(dpy, &w->alpha_border_pict, w->alpha_border_level);
 
   if (w->shadow_pict) {
     XRenderFreePicture(dpy, w->shadow_pict);
@@ -1635,8 +2127,8 @@ determine_mode(Display *dpy, win *w) {
 
   w->mode = mode;
 
-  if (w->extents) {
-    add_damage(dpy, w->extents);
+  if (w->has_extents) {
+    add_damage_win(dpy, w);
   }
 }
 
@@ -1672,28 +2164,21 @@ win_suggest_opacity(win* w, bool* is_userdefined){
 
 
 static void
-add_win(Display *dpy, Window id, Window prev) {
-  win *new = calloc(1, sizeof(win));
-  win **p;
+_map_win(Display *dpy, win *w, wintype type, Bool fade);
 
-  if (unlikely(!new)) return;
+/// Add a window, whose attributes etc. were fetched by wininfo_fetch(WININFO_ATTRS |
+/// WININFO_OPACITY).
+static void
+add_win_info(Display *dpy, WinInfo *info, Window prev) {
+  Window id = info->id;
+  win *new;
 
-  if (prev) {
-    for (p = &list; *p; p = &(*p)->next) {
-      if ((*p)->id == prev && !(*p)->destroyed)
-        break;
-    }
-  } else {
-    p = &list;
-  }
+  if (unlikely(!info->valid)) return;
+  new = calloc(1, sizeof(win));
+  if (unlikely(!new)) return;
 
   new->id = id;
-  set_ignore(dpy, NextRequest(dpy));
-
-  if (unlikely(!XGetWindowAttributes(dpy, id, &new->a))) {
-    free(new);
-    return;
-  }
+  new->a = info->a;
 
 #if HAS_NAME_WINDOW_PIXMAP
   new->pixmap = None;
@@ -1701,20 +2186,16 @@ add_win(Display *dpy, Window id, Window prev) {
   new->picture = None;
 
   if (new->a.class == InputOnly) {
-    // we used calloc, so no need to set zeroes
-    // new->damage_sequence = 0;
     new->damage = None;
   } else {
-    new->damage_sequence = NextRequest(dpy);
     set_ignore(dpy, NextRequest(dpy));
-    new->damage = XDamageCreate(dpy, id, XDamageReportNonEmpty);
+    new->damage = XDamageCreate(dpy, id, XDamageReportDeltaRectangles);
+    if (has_shape) XShapeSelectInput(dpy, id, ShapeNotifyMask);
   }
 
   new->alpha_pict = None;
   new->alpha_border_pict = None;
   new->shadow_pict = None;
-  new->border_size = None;
-  new->extents = None;
   new->shadow = None;
 
   // we used calloc, so no need to set zeroes
@@ -1737,67 +2218,102 @@ add_win(Display *dpy, Window id, Window prev) {
 
   new->opacity = OPAQUE;
 
-  new->border_clip = None;
-  get_frame_extents(new,
-    &new->left_width, &new->right_width,
-    &new->top_width, &new->bottom_width);
+  if (likely(info->complete)) {
+    if (info->client) {
+      if (info->client != id) win_register_client_events(info->client);
+      new->left_width = info->frame_extents[0];
+      new->right_width = info->frame_extents[1];
+      new->top_width = info->frame_extents[2];
+      new->bottom_width = info->frame_extents[3];
+    }
+    new->hidden_type = info->hidden ? HIDDEN_YES : HIDDEN_NO;
+  } else {
+    get_frame_extents(new,
+      &new->left_width, &new->right_width,
+      &new->top_width, &new->bottom_width);
+  }
 
-  new->next = *p;
-  *p = new;
+  // above prev, on top without one
+  win_list_insert_above(new, prev ? find_win(prev) : list);
+  win_table_insert(new);
 
   if (new->a.map_state == IsViewable) {
-    new->window_type = determine_wintype(dpy, id, id);
-    new->opacity = win_suggest_opacity(new, &new->userdefined_opacity);
-    map_win(dpy, id, new->damage_sequence - 1, True);
+    new->window_type = likely(info->complete) ? info->type :
+                       determine_wintype(dpy, id, id);
+    if (likely(info->complete)) {
+      uint default_op = (uint)(win_type_opacity[new->window_type]*OPAQUE);
+      new->opacity = info->has_opacity ? info->opacity : default_op;
+      new->userdefined_opacity = new->opacity != default_op;
+    } else {
+      new->opacity = win_suggest_opacity(new, &new->userdefined_opacity);
+    }
+    _map_win(dpy, new, new->window_type, True);
   }
 }
 
+static void
+add_win(Display *dpy, Window id, Window prev) {
+  WinInfo info;
+  wininfo_fetch(&id, 1, &info, WININFO_ATTRS | WININFO_OPACITY, win_type);
+  add_win_info(dpy, &info, prev);
+}
+
 static void
 set_paint_ignore_region_dirty(void){
   g_paint_ignore_region_is_dirty = True;
 }
 
-void
-restack_win(Display *dpy, win *w, Window new_above) {
-  Window old_above;
-
-  if (w->next) {
-    old_above = w->next->id;
-  } else {
-    old_above = None;
-  }
-
-  if (old_above != new_above) {
-    win **prev;
+/// Recompute paint_needed from the top down to w (s. paint_all).
+static void
+set_occlusion_dirty(win *w){
+  if (w->occlusion_dirty) return;
+  w->occlusion_dirty = true;
+  g_occlusion_dirty_count++;
+}
 
-    /* unhook */
-    for (prev = &list; *prev; prev = &(*prev)->next) {
-      if ((*prev) == w) break;
-    }
+/// Place w directly above below, at the bottom, if below is NULL.
+static void
+restack_win_above(win *w, win *below) {
+  if (w->next == below || w == below) return;
 
-    *prev = w->next;
+  // Only the windows w passes change their occluders. The lowest of them is
+  // either w (moving down) or the window above it (moving up).
+  set_occlusion_dirty(w);
+  if (w->prev) set_occlusion_dirty(w->prev);
 
-    /* rehook */
-    for (prev = &list; *prev; prev = &(*prev)->next) {
-      if ((*prev)->id == new_above && !(*prev)->destroyed)
-        break;
-    }
+  win_list_unlink(w);
+  win_list_insert_above(w, below);
+}
 
-    w->next = *prev;
-    *prev = w;
-  }
+void
+restack_win(Display *dpy, win *w, Window new_above) {
+  restack_win_above(w, new_above ? find_win(new_above) : NULL);
 }
 
 static void
 do_configure_win(Display *dpy, win* w){
   XConfigureEvent* ce = &w->queue_configure;
 
+  // A pure restack only affects the occlusion of the windows it passed
+  // (s. restack_win_above), not that of all windows.
+  Bool moved = w->a.x != ce->x || w->a.y != ce->y ||
+               w->a.width != ce->width || w->a.height != ce->height ||
+               w->a.border_width != ce->border_width ||
+               w->a.override_redirect != ce->override_redirect;
+
   w->need_configure = False;
   w->a.x = ce->x;
   w->a.y = ce->y;
+  if (moved) {
+    // the shadow and the shape are relative to the window, just move them
+    w->border_size_valid = false;
+  }
   if (w->configure_size_changed) {
+    w->resize_time = get_time_in_milliseconds();
+    if (unlikely(!w->resize_time)) w->resize_time = 1;
 
 #if HAS_NAME_WINDOW_PIXMAP
+    // A picture of the window itself (s. win_resizing) stays valid.
     if (w->pixmap) {
       XFreePixmap(dpy, w->pixmap);
       w->pixmap = None;
@@ -1812,6 +2328,9 @@ do_configure_win(Display *dpy, win* w){
       XRenderFreePicture(dpy, w->shadow);
       w->shadow = None;
     }
+
+    // the server may not tell about a rescaled shape
+    if (w->shaped_type == SHAPED_YES) w->shaped_type = SHAPED_UNKNOWN;
   }
 
   w->a.width = ce->width;
@@ -1824,16 +2343,19 @@ do_configure_win(Display *dpy, win* w){
 #endif
       ) {
     // both, the old and new window position/size are damaged.
-    if (likely(w->extents != None)) {
-      add_damage(dpy, w->extents);
+    if (likely(w->has_extents)) {
+      add_damage_win(dpy, w);
     }
-    add_damage(dpy, win_extents(dpy, w));
+    win_extents(dpy, w);
+    add_damage_win(dpy, w);
   }
 
-  clip_changed = True;
   w->a.override_redirect = ce->override_redirect;
   w->configure_size_changed = false;
-  set_paint_ignore_region_dirty();
+  if (moved) {
+    clip_changed = True;
+    set_paint_ignore_region_dirty();
+  }
 }
 
 Bool g_configure_needed = False;
@@ -1871,76 +2393,61 @@ handle_ConfigureNotify(Display *dpy, XConfigureEvent *ce) {
 static void
 circulate_win(Display *dpy, XCirculateEvent *ce) {
   win *w = find_win(ce->window);
-  Window new_above;
 
   if (!w) return;
 
+  // Like a pure restack in do_configure_win: the windows passed are marked
+  // by restack_win_above, only w's area needs painting.
   if (ce->place == PlaceOnTop) {
-    new_above = list->id;
+    restack_win_above(w, list);
   } else {
-    new_above = None;
+    restack_win_above(w, NULL);
+  }
+  if (w->a.map_state == IsViewable && w->has_extents) {
+    add_damage_win(dpy, w);
   }
-
-  restack_win(dpy, w, new_above);
-  clip_changed = True;
 }
 
 static void
-finish_destroy_win(Display *dpy, Window id) {
-  win **prev, *w;
-
-  for (prev = &list; (w = *prev); prev = &w->next) {
-    if (w->id == id && w->destroyed) {
-      finish_unmap_win(dpy, w);
-      *prev = w->next;
-
-      if (w->alpha_pict) {
-        XRenderFreePicture(dpy, w->alpha_pict);
-        w->alpha_pict = None;
-      }
+finish_destroy_win(Display *dpy, win *w) {
+  finish_unmap_win(dpy, w);
+  if (w->occlusion_dirty) g_occlusion_dirty_count--;
+  if (w->damage_rearm) g_damage_rearm_count--;
+  if (w->damage_queued) g_damage_queued_count--;
+  win_list_unlink(w);
 
-      if (w->alpha_border_pict) {
-        XRenderFreePicture(dpy, w->alpha_border_pict);
-        w->alpha_border_pict = None;
-      }
+  release_alpha_pict(dpy, &w->alpha_pict, w->alpha_level);
+  release_alpha_pict(dpy, &w->alpha_border_pict, w->alpha_border_level);
 
-      if (w->shadow_pict) {
-        XRenderFreePicture(dpy, w->shadow_pict);
-        w->shadow_pict = None;
-      }
+  if (w->shadow_pict) {
+    XRenderFreePicture(dpy, w->shadow_pict);
+    w->shadow_pict = None;
+  }
 
-      /* fix leak, from freedesktop repo */
-      if (w->shadow) {
-        XRenderFreePicture (dpy, w->shadow);
-        w->shadow = None;
-      }
+  /* fix leak, from freedesktop repo */
+  if (w->shadow) {
+    XRenderFreePicture (dpy, w->shadow);
+    w->shadow = None;
+  }
 
-      if (w->damage != None) {
-        set_ignore(dpy, NextRequest(dpy));
-        XDamageDestroy(dpy, w->damage);
-        w->damage = None;
-      }
+  if (w->damage != None) {
+    set_ignore(dpy, NextRequest(dpy));
+    XDamageDestroy(dpy, w->damage);
+    w->damage = None;
+  }
 
-      cleanup_fade(dpy, w);
+  cleanup_fade(dpy, w);
 
-      if (w->border_clip) {
-        XFixesDestroyRegion(dpy, w->border_clip);
-        w->border_clip = None;
-      }
-      if(w->extents){
-        XFixesDestroyRegion(dpy, w->extents);
-        w->extents = None;
-      }
-      free(w);
-      break;
-    }
-  }
+  comp_region_free(&w->border_clip);
+  comp_region_free(&w->border_size);
+  comp_region_free(&w->shape);
+  free(w);
 }
 
 #if HAS_NAME_WINDOW_PIXMAP
 static void
 destroy_callback(Display *dpy, win *w) {
-  finish_destroy_win(dpy, w->id);
+  finish_destroy_win(dpy, w);
 }
 #endif
 
@@ -1948,19 +2455,21 @@ static void
 destroy_win(Display *dpy, Window id, Bool fade) {
   win *w = find_win(id);
 
-  if (w) w->destroyed = True;
+  if (!w) return;
+  w->destroyed = True;
+  win_table_remove(w);
 
   set_paint_ignore_region_dirty();
 
 #if HAS_NAME_WINDOW_PIXMAP
-  if (w && w->pixmap && fade && win_type_fade[w->window_type]) {
+  if (w->pixmap && fade && win_type_fade[w->window_type]) {
     set_fade(dpy, w, w->opacity * 1.0 / OPAQUE,
       0.0, fade_out_step, destroy_callback,
       False, True);
   } else
 #endif
   {
-    finish_destroy_win(dpy, id);
+    finish_destroy_win(dpy, w);
   }
 }
 
@@ -2042,7 +2551,19 @@ damage_win(Display *dpy, XDamageNotifyEvent *de) {
 
   if (w->usable)
 #endif
-    repair_win(dpy, w);
+    queue_damage(w, &de->area);
+}
+
+static void
+shape_win(Display *dpy, XShapeEvent *se) {
+  win *w = find_win(se->window);
+
+  if (unlikely(!w) || se->kind != ShapeBounding) return;
+  w->shaped_type = SHAPED_UNKNOWN;
+  w->border_size_valid = false;
+  if (w->has_extents) {
+    add_damage_win(dpy, w);
+  }
 }
 
 static int
@@ -2107,10 +2628,26 @@ error(Display *dpy, XErrorEvent *ev) {
   return 0;
 }
 
+/// A background property of root changed. The tile is kept, if it still shows
+/// the same pixmap, which may have been drawn to, though: repaint it anyway.
+static void
+root_background_changed(Display *dpy) {
+  XRectangle root_rect = { .x=0, .y=0,
+                           .width=root_width , .height=root_height };
+  unsigned depth;
+
+  if (!root_tile) return;
+  if (root_tile_pixmap == None ||
+      root_background_pixmap(&depth) != root_tile_pixmap) {
+    XRenderFreePicture(dpy, root_tile);
+    root_tile = None;
+  }
+  add_damage(&root_rect);
+}
+
 static void
 expose_root(Display *dpy, Window root, XRectangle *rects, int nrects) {
-  XFixesSetRegion(dpy, g_xregion_tmp, rects, nrects);
-  add_damage(dpy, g_xregion_tmp);
+  for (int i = 0; i < nrects; i++) add_damage(&rects[i]);
 }
 
 #if DEBUG_EVENTS
@@ -2224,7 +2761,15 @@ usage(char *program, int exitcode) {
     --shadow-green value
     Green color value of shadow (0.0 - 1.0, defaults to 0).
     --shadow-blue value
-    Blue color value of shadow (0.0 - 1.0, defaults to 0).)SOMERANDOMTEXT"
+    Blue color value of shadow (0.0 - 1.0, defaults to 0).
+    --stats
+    Print event statistics on exit. They are also printed on SIGUSR1.
+    --no-unredirect
+    Keep compositing opaque fullscreen windows instead of unredirecting them.
+    --control-socket path
+    Answer fastcompmgr-ctl on this Unix socket, abstract if it starts with @.
+    --record file
+    Record the processed X events to file, for replay with bench/fcm-replay.)SOMERANDOMTEXT"
   );
   fprintf(stderr, "\n");
 
@@ -2267,6 +2812,9 @@ register_cm (Display *dpy)
 
   w = XCreateSimpleWindow (dpy, RootWindow (dpy, g_screen), 0, 0, 1, 1, 0, None,
           None);
+  cm_window = w;
+  // PropertyNotify on it marks the completion of a frame (s. do_paint).
+  XSelectInput (dpy, w, PropertyChangeMask);
 
   Xutf8SetWMProperties (dpy, w, "fastcompmgr", "fastcompmgr", NULL, 0, NULL, NULL,
       NULL);
@@ -2275,6 +2823,56 @@ register_cm (Display *dpy)
   return True;
 }
 
+/// The signals are blocked except while waiting in ppoll, so the main loop
+/// sees each one right away: there, or at its next wait.
+static void
+signal_handler(int sig) {
+  g_signal = sig;
+}
+
+/// Fill in the counters, which are not updated as they change.
+static void
+stats_update(void) {
+  win *w;
+  // includes those sent through xcb directly, s. wininfo_fetch
+  g_stats.requests = NextRequest(dpy) - 1 - g_stats.requests_base;
+  g_stats.refresh_hz = monitors_max_refresh_hz();
+  g_stats.paint_cost_us = g_paint_cost_us;
+  g_stats.windows = g_stats.windows_mapped = 0;
+  for (w = list; w; w = w->next) {
+    g_stats.windows++;
+    if (w->a.map_state == IsViewable) g_stats.windows_mapped++;
+  }
+}
+
+static void
+ctl_report(FILE *f) {
+  stats_update();
+  stats_print(f, damage_event);
+}
+
+static void
+ctl_reset(void) {
+  stats_update();
+  stats_reset();
+}
+
+static void
+handle_signal(void) {
+  int sig = g_signal;
+  g_signal = 0;
+  stats_update();
+  switch (sig) {
+  case SIGUSR1:
+    stats_print(stderr, damage_event);
+    break;
+  case SIGINT:
+  case SIGTERM:
+    if (print_stats) stats_print(stderr, damage_event);
+    exit(0);
+  }
+}
+
 static void run_configures(Display *dpy){
   win *w;
   for (w = list; w; w = w->next) {
@@ -2284,51 +2882,303 @@ static void run_configures(Display *dpy){
   }
 }
 
+/// Returns the topmost window, if it is opaque, covers the whole screen and has
+/// no shadow, so nothing composited would be visible anyway.
+static win*
+find_fullscreen_win(void){
+  win *w;
+  for (w = list; w; w = w->next) {
+    if (w->a.map_state == IsViewable && !w->destroyed) break;
+  }
+  if (!w || w->mode != WINDOW_SOLID || w->opacity != OPAQUE ||
+      HAS_FRAME_OPACITY(w) || shadow_should_render(w->shadow_type) ||
+      w->hidden_type == HIDDEN_YES || find_fade(w)) {
+    return NULL;
+  }
+  if (w->a.x > 0 || w->a.y > 0 ||
+      w->a.x + w->a.width + w->a.border_width * 2 < root_width ||
+      w->a.y + w->a.height + w->a.border_width * 2 < root_height) {
+    return NULL;
+  }
+  return w;
+}
+
+/// Drop the (now stale) window pixmaps after switching redirection.
+static void
+release_win_pictures(Display *dpy){
+  win *w;
+  for (w = list; w; w = w->next) {
+#if HAS_NAME_WINDOW_PIXMAP
+    if (w->pixmap) {
+      XFreePixmap(dpy, w->pixmap);
+      w->pixmap = None;
+    }
+#endif
+    if (w->picture) {
+      set_ignore(dpy, NextRequest(dpy));
+      XRenderFreePicture(dpy, w->picture);
+      w->picture = None;
+    }
+  }
+}
+
+/// While a fullscreen opaque window is on top, unredirect the windows, so the
+/// server draws it directly and we stop painting. Redirect again, as soon as
+/// anything else becomes visible. Returns true, if painting is bypassed.
+/// Note that a single window cannot be unredirected while its parent (root)
+/// redirects all subwindows, so we toggle the redirection of root.
+static bool
+update_unredirect(Display *dpy){
+  bool fullscreen = unredir_fullscreen && find_fullscreen_win() != NULL;
+
+  if (likely(fullscreen == g_unredirected)) return fullscreen;
+
+  if (fullscreen) {
+    set_ignore(dpy, NextRequest(dpy));
+    XCompositeUnredirectSubwindows(dpy, root, CompositeRedirectManual);
+    release_win_pictures(dpy);
+    g_stats.unredirects++;
+  } else {
+    XRectangle root_rect = { .x=0, .y=0,
+                             .width=root_width , .height=root_height };
+    XCompositeRedirectSubwindows(dpy, root, CompositeRedirectManual);
+    release_win_pictures(dpy);
+    // the screen shows the unredirected window, not root_buffer
+    root_buffer_age = 0;
+    add_damage(&root_rect);
+    clip_changed = True;
+    set_paint_ignore_region_dirty();
+  }
+  g_unredirected = fullscreen;
+  return fullscreen;
+}
+
+/// Instead of blocking on XSync after each frame, we append a property change
+/// on our own window to the frame's requests. The server processes requests in
+/// order, so once its PropertyNotify arrives, the frame is done. Meanwhile we
+/// keep processing events and collect damage for the next frame, but never
+/// have more than one frame in flight.
+static void
+frame_mark(Display *dpy){
+  long serial = (long)NextRequest(dpy);
+  XChangeProperty(dpy, cm_window, atom_frame_marker, XA_CARDINAL, 32,
+                  PropModeReplace, (unsigned char *)&serial, 1);
+  XFlush(dpy);
+  g_frame_pending = True;
+  g_frame_deferred = False;
+  g_frame_time = get_time_in_milliseconds();
+  g_frame_submit_time = get_time_in_microseconds();
+}
+
+static void
+frame_done(void){
+  // Weight of the newest frame in the moving average of frame durations.
+  const double PAINT_COST_WEIGHT = 0.125;
+  long now = get_time_in_microseconds();
+
+  long cost = now - g_frame_start_time;
+
+  g_frame_pending = False;
+  g_stats.frames++;
+  g_stats.server_wait_us += now - g_frame_submit_time;
+  stats_add_latency(now - g_frame_damage_time);
+  if (unlikely(g_paint_cost_us == 0)) {
+    g_paint_cost_us = cost;
+  } else {
+    g_paint_cost_us += PAINT_COST_WEIGHT * (cost - g_paint_cost_us);
+  }
+  for (int i = 0; i < num_monitors; i++) {
+    Monitor *m = &monitors[i];
+    if (!(g_frame_monitors & (1u << i))) continue;
+    if (unlikely(m->paint_cost_us == 0)) {
+      m->paint_cost_us = cost;
+    } else {
+      m->paint_cost_us += PAINT_COST_WEIGHT * (cost - m->paint_cost_us);
+    }
+  }
+}
+
+// Never wait forever for a frame, e.g. if a marker got lost.
+#define FRAME_TIMEOUT_MILISEC 1000
+
+/// Returns true, while the previous frame is still being processed by the server.
+static Bool
+frame_in_flight(void){
+  if (likely(!g_frame_pending)) return False;
+  if (unlikely(get_time_in_milliseconds() - g_frame_time > FRAME_TIMEOUT_MILISEC)) {
+    g_frame_pending = False;
+    return False;
+  }
+  // count each postponed paint once, not every check while it waits
+  if (!g_frame_deferred && (all_damage_is_dirty || g_damage_queued_count
+                            || g_configure_needed)) {
+    g_frame_deferred = True;
+    g_stats.frames_deferred++;
+  }
+  return True;
+}
+
+/// Milliseconds until the frame in flight is given up on, -1 if there is none.
+static int
+frame_timeout(void){
+  int ms;
+  if (!g_frame_pending) return -1;
+  ms = g_frame_time + FRAME_TIMEOUT_MILISEC + 1 - get_time_in_milliseconds();
+  return (ms > 0) ? ms : 0;
+}
+
+/// Paint the damage of the monitors in mask in one frame. The damage of other
+/// monitors is left for later.
 static void
-do_paint(Display *dpy){
-   paint_all(dpy, all_damage);
-   XSync(dpy, False);
+do_paint(Display *dpy, unsigned mask){
+   Bool any = False;
+   int i;
+
+   rearm_damage(dpy);
+   if (unlikely(update_unredirect(dpy))) {
+     for (i = 0; i < num_monitors; i++) monitors[i].damaged = False;
+     all_damage_is_dirty = False;
+     return;
+   }
+
+   g_frame_monitors = 0;
    all_damage_is_dirty = False;
+   for (i = 0; i < num_monitors; i++) {
+     Monitor *m = &monitors[i];
+     if (!m->damaged) continue;
+     if (!(mask & (1u << i))) {
+       all_damage_is_dirty = True;
+       continue;
+     }
+     if (any) {
+       comp_region_op(&all_damage, &all_damage, &m->damage, COMP_REGION_UNION);
+       if (m->damage_time < g_frame_damage_time) g_frame_damage_time = m->damage_time;
+     } else {
+       comp_region_copy(&all_damage, &m->damage);
+       g_frame_damage_time = m->damage_time;
+       any = True;
+     }
+     m->damaged = False;
+     g_frame_monitors |= 1u << i;
+   }
+   if (!any) return;
+
+   g_frame_start_time = get_time_in_microseconds();
+   paint_all(dpy, &all_damage);
+   stats_add_paint(get_time_in_microseconds() - g_frame_start_time);
+   if (unlikely(synchronize)) {
+     g_frame_submit_time = get_time_in_microseconds();
+     XSync(dpy, False);
+     frame_done();
+   } else {
+     frame_mark(dpy);
+   }
    clip_changed = False;
 }
 
 static Bool configure_timer_started = False;
-static int configure_time = 0;
+static int configure_deadline = 0;
+static unsigned configure_monitors = 0; // held back until configure_deadline
+
+/// The monitors touched by pending configure events (old and new position).
+static unsigned
+pending_configure_monitors(void){
+  unsigned mask = 0;
+  XRectangle r;
+  win *w;
+
+  for (w = list; w; w = w->next) {
+    if (!w->need_configure || w->destroyed) continue;
+    win_current_bounds(w, &r);
+    mask |= monitors_mask(&r);
+    win_bounds(w, w->queue_configure.x, w->queue_configure.y,
+               w->queue_configure.width + w->queue_configure.border_width * 2,
+               w->queue_configure.height + w->queue_configure.border_width * 2, &r);
+    mask |= monitors_mask(&r);
+  }
+  return mask;
+}
+
+/// The interval in which configure events are coalesced: painting faster than
+/// the display refreshes is wasted, painting faster than a frame takes to
+/// render only queues up work. Of the monitors in mask, the fastest decides.
+static int
+configure_interval(unsigned mask){
+  const int MIN_MILISEC = 1;
+  const int MAX_MILISEC = 50;
+  double us = 0;
+  int ms;
+
+  for (int i = 0; i < num_monitors; i++) {
+    Monitor *m = &monitors[i];
+    if (!(mask & (1u << i))) continue;
+    double refresh_us = 1000000.0 / (m->refresh_hz > 0 ? m->refresh_hz : 60.0);
+    double mus = (m->paint_cost_us > refresh_us) ? m->paint_cost_us : refresh_us;
+    if (us == 0 || mus < us) us = mus;
+  }
+  if (us == 0) {
+    double refresh_us = 1000000.0 / monitors_max_refresh_hz();
+    us = (g_paint_cost_us > refresh_us) ? g_paint_cost_us : refresh_us;
+  }
+  ms = (int)(us / 1000.0 + 0.5);
+
+  if (ms < MIN_MILISEC) ms = MIN_MILISEC;
+  if (ms > MAX_MILISEC) ms = MAX_MILISEC;
+  return ms;
+}
+
+/// Milliseconds until the pending configure events are due, -1 if none are.
+static int
+configure_timeout(void){
+  int ms;
+  if (!configure_timer_started) return -1;
+  ms = configure_deadline - get_time_in_milliseconds();
+  return (ms > 0) ? ms : 0;
+}
 
 /// When a window is moved, or resized, a lot of ConfigureNotify events
 /// occur. However, painting and Xsyncing of complex windows, e.g.
 /// web-browser contents, may introduce a considerable lag. Therefore, for each
 /// window, we cache the "latest" configure event and paint the events after
-/// some timeout. On the other hand, we want to handle other events, especially
-/// damage events, as fast as possible, so we do not timeout in this case.
+/// some timeout, which adapts to the refresh rate and the measured paint cost
+/// of the affected monitors (s. configure_interval). Only those monitors are
+/// held back meanwhile. On the other hand, we want to handle other events,
+/// especially damage events, as fast as possible, so we do not timeout in this case.
 static void
 check_paint(Display *dpy){
+  unsigned hold = 0;
+
+  // fades and held back configures are due now
+  g_damage_origin = get_time_in_microseconds();
+  run_fades(dpy);
+  // Keep collecting damage until the previous frame completed.
+  if (frame_in_flight()) return;
   if(unlikely(g_configure_needed)){
-    const int EVERY_MILISEC = 2;
+    int interval;
     if(!configure_timer_started){
       // Not strictly necessary to paint now, but until we run, the
       // configured window has already been moving/resizing for a (short)
       // while, so give early feedback to the user.
+      configure_monitors = pending_configure_monitors();
       run_configures(dpy);
-      do_paint(dpy);
+      interval = configure_interval(configure_monitors);
       configure_timer_started = True;
-      configure_time = get_time_in_milliseconds() + EVERY_MILISEC;
+      configure_deadline = get_time_in_milliseconds() + interval;
+      g_stats.configure_paints++;
+      g_stats.configure_interval_ms += interval;
+    } else if (configure_timeout() > 0){
+      hold = configure_monitors | pending_configure_monitors();
     } else {
-      int delta;
-      delta = get_time_in_milliseconds() - configure_time;
-      if (delta < EVERY_MILISEC){
-        return;
-      }
       g_configure_needed = False;
       configure_timer_started = False;
       run_configures(dpy);
-      do_paint(dpy);
-    }
-  } else {
-    if(likely(all_damage_is_dirty)) {
-      do_paint(dpy);
     }
   }
+  // after the configures: the damage is painted where the windows are now
+  flush_damage(dpy);
+  if(likely(all_damage_is_dirty)) {
+    do_paint(dpy, ~hold);
+  }
 }
 
 
@@ -2339,6 +3189,10 @@ main(int argc, char **argv) {
     { "shadow-green", required_argument, NULL, 0 },
     { "shadow-blue", required_argument, NULL, 0 },
     { "help", no_argument, NULL, 0 },
+    { "stats", no_argument, NULL, 0 },
+    { "no-unredirect", no_argument, NULL, 0 },
+    { "control-socket", required_argument, NULL, 0 },
+    { "record", required_argument, NULL, 0 },
     { 0, 0, 0, 0 },
   };
 
@@ -2351,7 +3205,8 @@ main(int argc, char **argv) {
   int size_expose = 0;
   int n_expose = 0;
   struct pollfd ufd;
-  int p;
+  char *control_socket = NULL;
+  char *record_path = NULL;
   int composite_major, composite_minor;
   double shadow_red = 0.0;
   double shadow_green = 0.0;
@@ -2380,6 +3235,10 @@ main(int argc, char **argv) {
           case 1: shadow_green = normalize_d(atof(optarg)); break;
           case 2: shadow_blue = normalize_d(atof(optarg)); break;
           case 3: usage(argv[0], 0); break;
+          case 4: print_stats = True; break;
+          case 5: unredir_fullscreen = False; break;
+          case 6: control_socket = optarg; break;
+          case 7: record_path = optarg; break;
           default:
             fprintf(stderr, "Bug, unhandeled longopt_idx %d\n", longopt_idx);
             exit(2);
@@ -2466,6 +3325,7 @@ main(int argc, char **argv) {
     win_type_shadow[WINTYPE_DOCK] = False;
   }
 
+  time_init();
   dpy = XOpenDisplay(display);
   if (!dpy) {
     fprintf(stderr, "Can't open display\n");
@@ -2510,12 +3370,17 @@ main(int argc, char **argv) {
     exit(1);
   }
 
+  // Without it, all windows are rectangular.
+  has_shape = XShapeQueryExtension(dpy, &shape_event, &shape_error);
+
   if(! register_cm(dpy))
     exit(1);
 
   /* get atoms */
   atom_opacity = XInternAtom(dpy,
     "_NET_WM_WINDOW_OPACITY", False);
+  atom_frame_marker = XInternAtom(dpy,
+    "_FASTCOMPMGR_FRAME", False);
   atom_win_type = XInternAtom(dpy,
     "_NET_WM_WINDOW_TYPE", False);
   atom_pixmap = XInternAtom(dpy,
@@ -2563,12 +3428,17 @@ main(int argc, char **argv) {
   win_type[WINTYPE_DND] = XInternAtom(dpy,
     "_NET_WM_WINDOW_TYPE_DND", False);
 
-  gaussian_map = make_gaussian_map(dpy, shadow_radius);
+  gaussian_map = gauss_map_new(shadow_radius);
+  if (!gaussian_map) {
+    fprintf(stderr, "fastcompmgr error: failed to allocate the shadow kernel\n");
+    exit(1);
+  }
   presum_gaussian(gaussian_map);
 
   if(!root_init()){
     exit(1);
   }
+  monitors_init();
 
   black_picture = solid_picture(dpy, True, 1, 0, 0, 0);
 
@@ -2579,9 +3449,8 @@ main(int argc, char **argv) {
     cshadow_picture = solid_picture(dpy, True, 1,
         shadow_red, shadow_green, shadow_blue);
 
-  all_damage = XFixesCreateRegion(dpy, 0, 0);
   all_damage_is_dirty = False;
-  g_xregion_tmp = XFixesCreateRegion(dpy, 0, 0);
+  g_damage_origin = get_time_in_microseconds();
 
   clip_changed = True;
   XGrabServer(dpy);
@@ -2598,38 +3467,101 @@ main(int argc, char **argv) {
   XQueryTree(dpy, root, &root_return,
     &parent_return, &children, &nchildren);
 
-  for (i = 0; i < nchildren; i++) {
-    add_win(dpy, children[i], i ? children[i-1] : None);
+  {
+    // Fetch all windows at once instead of several round-trips per window.
+    WinInfo *infos = malloc(nchildren * sizeof(WinInfo));
+    if (unlikely(!infos && nchildren)) {
+      fprintf(stderr, "fastcompmgr error: failed to allocate window info\n");
+      exit(1);
+    }
+    wininfo_fetch(children, nchildren, infos, WININFO_ATTRS | WININFO_OPACITY,
+                  win_type);
+    for (i = 0; i < nchildren; i++) {
+      add_win_info(dpy, &infos[i], i ? children[i-1] : None);
+    }
+    free(infos);
   }
 
   XFree(children);
 
+  if (record_path) {
+    if (!trace_open(record_path, root, root_width, root_height,
+                    damage_event, has_shape ? shape_event : 0)) {
+      exit(1);
+    }
+    for (win *w = list; w; w = w->next) trace_window(w->id, &w->a);
+  }
+
   XUngrabServer(dpy);
 
   ufd.fd = ConnectionNumber(dpy);
   ufd.events = POLLIN;
+  if (control_socket && !ctl_init(control_socket, ctl_report, ctl_reset)) {
+    exit(1);
+  }
 
   {
-    XRectangle root_rect = { .x=0, .y=0,
-                             .width=root_width , .height=root_height };
-    XFixesSetRegion(dpy, g_xregion_tmp, &root_rect, 1);
-    paint_all(dpy, g_xregion_tmp);
+    struct sigaction sa = { .sa_handler = signal_handler };
+    sigset_t block;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &block, &g_poll_sigmask);
+  }
+
+  {
+    CompBox root_box = { .x1 = 0, .y1 = 0, .x2 = root_width, .y2 = root_height };
+    comp_region_set_box(&all_damage, &root_box);
+    paint_all(dpy, &all_damage);
   }
 
   for (;;) {
     /*    dump_wins(); */
     do {
       if (!QLength(dpy)) {
-        // TODO: check and re-implement fade time logic.
-        int timeout = (configure_timer_started) ? 2 : fade_timeout();
-        if (unlikely(poll(&ufd, 1, timeout) == 0)) {
+        struct pollfd fds[1 + CTL_MAX_FDS];
+        int nctl = ctl_pollfds(fds + 1);
+        fds[0] = ufd;
+        // Wake up for the earliest of the configure, fade, frame and control
+        // client deadlines, not at all, when none is pending.
+        int timeout = configure_timeout();
+        int fade_ms = fade_timeout();
+        int frame_ms = frame_timeout();
+        int ctl_ms = ctl_timeout();
+        if (fade_ms >= 0 && (timeout < 0 || fade_ms < timeout)) timeout = fade_ms;
+        if (frame_ms >= 0 && (timeout < 0 || frame_ms < timeout)) timeout = frame_ms;
+        if (ctl_ms >= 0 && (timeout < 0 || ctl_ms < timeout)) timeout = ctl_ms;
+        struct timespec ts = { timeout / 1000, (timeout % 1000) * 1000000L };
+        int res = ppoll(fds, 1 + nctl, timeout < 0 ? NULL : &ts, &g_poll_sigmask);
+        if (unlikely(res == 0)) {
           check_paint(dpy);
-           //   run_fades(dpy);
           break;
         }
+        if (unlikely(res < 0)) {
+          if (errno != EINTR) {
+            perror("ppoll");
+            exit(1);
+          }
+          handle_signal();
+          break;
+        }
+        if (unlikely(nctl)) {
+          ctl_handle(fds + 1, nctl);
+          // only a control client: don't block in XNextEvent
+          if (!fds[0].revents) break;
+        }
       }
 
       XNextEvent(dpy, &ev);
+      // the damage caused by the event dates from its reading
+      g_damage_origin = get_time_in_microseconds();
+      g_stats_event = ev.type & 0x7f;
+      g_stats.events[g_stats_event]++;
 
       if (likely((ev.type & 0x7f) != KeymapNotify)) {
         discard_ignore(dpy, ev.xany.serial);
@@ -2734,16 +3666,14 @@ main(int argc, char **argv) {
           }
           break;
         case PropertyNotify:
-          for (p = 0; root_background_props[p]; p++) {
-            if (ev.xproperty.atom ==
-                XInternAtom(dpy, root_background_props[p], False)) {
-              if (root_tile) {
-                XClearArea(dpy, root, 0, 0, 0, 0, True);
-                XRenderFreePicture(dpy, root_tile);
-                root_tile = None;
-                break;
-              }
-            }
+          if (ev.xproperty.window == cm_window) {
+            if (ev.xproperty.atom == atom_frame_marker) frame_done();
+            break;
+          }
+          if (ev.xproperty.window == root &&
+              root_is_background_atom(ev.xproperty.atom)) {
+            root_background_changed(dpy);
+            break;
           }
           // if (ev.xproperty.atom == atom_net_active_window) {
           //   fprintf(stderr, "active win changed\n");
@@ -2769,9 +3699,24 @@ main(int argc, char **argv) {
         default:
           if (likely(ev.type == damage_event + XDamageNotify)) {
             damage_win(dpy, (XDamageNotifyEvent *)&ev);
+          } else if (has_shape && ev.type == shape_event + ShapeNotify) {
+            shape_win(dpy, (XShapeEvent *)&ev);
+          } else if (monitors_handle_event(&ev)) {
+            // all monitors are damaged now
+            all_damage_is_dirty = True;
           }
           break;
       }
+      if (unlikely(record_path)) {
+        win *w = NULL;
+        if (ev.type == CreateNotify) {
+          w = find_win(ev.xcreatewindow.window);
+        } else if (ev.type == ReparentNotify && ev.xreparent.parent == root) {
+          w = find_win(ev.xreparent.window);
+        }
+        trace_event(&ev, w ? &w->a : NULL);
+      }
+      g_stats_event = 0;
     } while (QLength(dpy));
 
     check_paint(dpy);
@@ -496,26 +496,47 @@ static char curssn[NAME_MAX + 1];
 #endif
 
 /* pthread related */
-#define NUM_DU_THREADS (4) /* Can use sysconf(_SC_NPROCESSORS_ONLN) */
-#define DU_TEST (((node->fts_info & FTS_F) && \
-		(sb->st_nlink <= 1 || test_set_bit((uint_t)sb->st_ino))) || node->fts_info & FTS_DP)
+#define DU_MAX_THREADS (64)
+#define DU_JOBS_PER_THREAD (4) /* Queued jobs per worker before dirwalk() waits */
 
-static int threadbmp = -1; /* Has 1 in the bit position for idle threads */
-static volatile int active_threads;
-static pthread_mutex_t running_mutex = PTHREAD_MUTEX_INITIALIZER;
+typedef struct du_job {
+	struct du_job *next;
+	int entnum; /* Entry to add the subtree size to, -1 for none */
+	bool mntpoint;
+	bool split; /* A subtree handed over by another job */
+	char path[];
+} du_job;
+
+static pthread_mutex_t du_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t du_work_cond = PTHREAD_COND_INITIALIZER; /* Job queued */
+static pthread_cond_t du_done_cond = PTHREAD_COND_INITIALIZER; /* Job finished */
 static pthread_mutex_t hardlink_mutex = PTHREAD_MUTEX_INITIALIZER;
-static ullong_t *core_files;
-static blkcnt_t *core_blocks;
+static du_job *du_head, *du_tail;
+static int du_queued; /* Jobs in the queue */
+static int du_pending; /* Jobs queued or running */
+static int du_idle; /* Workers waiting for a job */
+static int num_du_threads;
+static blkcnt_t du_blocks;
+static ullong_t du_files;
 static ullong_t num_files;
 
-typedef struct {
-	char path[PATH_MAX];
-	int entnum;
-	ushort_t core;
-	bool mntpoint;
-} thread_data;
+/* Disk usage cache */
+#define DU_CACHE_MAGIC "nnndu02"
 
-static thread_data *core_data;
+typedef struct {
+	dev_t dev;
+	ino_t ino; /* 0 marks a free slot */
+	long long mtime; /* ns, when the dir was walked */
+	long long ctime;
+	blkcnt_t blocks; /* Own usage: the dir and its direct non-dir entries */
+	off_t size; /* ... apparent size */
+	uint_t files;
+} du_cent;
+
+static pthread_mutex_t du_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static du_cent *du_cache; /* Open addressing, du_cache_size is a power of 2 */
+static size_t du_cache_size;
+static size_t du_cache_used;
 
 /* Retain old signal handlers */
 static struct sigaction oldsighup;
@@ -5777,88 +5798,380 @@ static bool handle_cmd(enum action sel, char *path, char *newpath)
 	return TRUE;
 }
 
+static size_t du_cache_slot(dev_t dev, ino_t ino)
+{
+	ullong_t h = ((ullong_t)dev * 0x9E3779B97F4A7C15ULL ^ (ullong_t)ino) * 0x9E3779B97F4A7C15ULL;
+	size_t i = (size_t)(h >> 32) & (du_cache_size - 1);
+
+	while (du_cache[i].ino && (du_cache[i].ino != ino || du_cache[i].dev != dev))
+		i = (i + 1) & (du_cache_size - 1);
+
+	return i;
+}
+
+/* Call with du_cache_mutex held */
+static bool du_cache_grow(void)
+{
+	du_cent *old = du_cache;
+	size_t oldsize = du_cache_size;
+	size_t size = oldsize ? oldsize << 1 : 4096;
+	du_cent *tmp = calloc(size, sizeof(du_cent));
+
+	if (!tmp)
+		return FALSE;
+
+	du_cache = tmp;
+	du_cache_size = size;
+	for (size_t i = 0; i < oldsize; ++i)
+		if (old[i].ino)
+			du_cache[du_cache_slot(old[i].dev, old[i].ino)] = old[i];
+
+	free(old);
+	return TRUE;
+}
+
+/* Key and timestamps of a dir, with its own inode as usage */
+static void du_cent_init(du_cent *c, const struct stat *sb)
+{
+	c->dev = sb->st_dev;
+	c->ino = sb->st_ino;
+#ifdef __APPLE__
+	c->mtime = sb->st_mtimespec.tv_sec * 1000000000LL + sb->st_mtimespec.tv_nsec;
+	c->ctime = sb->st_ctimespec.tv_sec * 1000000000LL + sb->st_ctimespec.tv_nsec;
+#else
+	c->mtime = sb->st_mtim.tv_sec * 1000000000LL + sb->st_mtim.tv_nsec;
+	c->ctime = sb->st_ctim.tv_sec * 1000000000LL + sb->st_ctim.tv_nsec;
+#endif
+	c->blocks = sb->st_blocks;
+	c->size = sb->st_size;
+	c->files = 1;
+}
+
+/* Fill in the cached usage of the dir in c, if its mtime and ctime are unchanged */
+static bool du_cache_get(du_cent *c)
+{
+	bool found = FALSE;
+
+	pthread_mutex_lock(&du_cache_mutex);
+	if (du_cache) {
+		du_cent *e = &du_cache[du_cache_slot(c->dev, c->ino)];
+
+		if (e->ino && e->mtime == c->mtime && e->ctime == c->ctime) {
+			*c = *e;
+			found = TRUE;
+		}
+	}
+	pthread_mutex_unlock(&du_cache_mutex);
+
+	return found;
+}
+
+static void du_cache_put(const du_cent *c)
+{
+	pthread_mutex_lock(&du_cache_mutex);
+	/* Keep the load factor below 3/4 */
+	if ((du_cache_used + 1) << 2 <= du_cache_size * 3 || du_cache_grow()) {
+		du_cent *e = &du_cache[du_cache_slot(c->dev, c->ino)];
+
+		if (!e->ino)
+			++du_cache_used;
+		*e = *c;
+	}
+	pthread_mutex_unlock(&du_cache_mutex);
+}
+
+/* Load the cache persisted at NNN_DU_CACHE, if set */
+static void du_cache_load(void)
+{
+	char *path = xgetenv("NNN_DU_CACHE", NULL);
+	char magic[sizeof(DU_CACHE_MAGIC)];
+	du_cent c;
+	FILE *fp;
+
+	if (!path || !(fp = fopen(path, "rb")))
+		return;
+
+	if (fread(magic, sizeof(magic), 1, fp) == 1
+	    && !memcmp(magic, DU_CACHE_MAGIC, sizeof(magic)))
+		while (fread(&c, sizeof(c), 1, fp) == 1)
+			if (c.ino)
+				du_cache_put(&c);
+
+	fclose(fp);
+}
+
+/* Persist the cache at NNN_DU_CACHE, if set */
+static void du_cache_save(void)
+{
+	char *path = xgetenv("NNN_DU_CACHE", NULL);
+	char tmp[PATH_MAX];
+	bool ok;
+	FILE *fp;
+	int fd;
+
+	if (!path || !du_cache)
+		return;
+
+	/* Write a copy and rename it, so an interrupted save keeps the old cache */
+	if (snprintf(tmp, PATH_MAX, "%s.tmp", path) >= PATH_MAX)
+		return;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1)
+		return;
+
+	fp = fdopen(fd, "wb");
+	if (!fp) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	pthread_mutex_lock(&du_cache_mutex);
+	ok = fwrite(DU_CACHE_MAGIC, sizeof(DU_CACHE_MAGIC), 1, fp) == 1;
+	for (size_t i = 0; ok && i < du_cache_size; ++i)
+		if (du_cache[i].ino)
+			ok = fwrite(&du_cache[i], sizeof(du_cent), 1, fp) == 1;
+	pthread_mutex_unlock(&du_cache_mutex);
+
+	if (fclose(fp) || !ok || rename(tmp, path))
+		unlink(tmp);
+}
+
 static void dentfree(void)
 {
 	free(pnamebuf);
 	free(pdents);
 	free(mark);
 
-	/* Thread data cleanup */
-	free(core_blocks);
-	free(core_data);
-	free(core_files);
+	du_cache_save();
 }
 
-static void *du_thread(void *p_data)
+/* Append a job to the queue, call with du_mutex held */
+static bool du_push(const char *path, int entnum, bool mntpoint, bool split)
 {
-	thread_data *pdata = (thread_data *)p_data;
-	char *path[2] = {pdata->path, NULL};
+	size_t len = strlen(path) + 1;
+	du_job *job = malloc(sizeof(du_job) + len);
+
+	if (!job)
+		return FALSE;
+
+	memcpy(job->path, path, len);
+	job->entnum = entnum;
+	job->mntpoint = mntpoint;
+	job->split = split;
+	job->next = NULL;
+
+	if (du_tail)
+		du_tail->next = job;
+	else
+		du_head = job;
+	du_tail = job;
+
+	++du_queued;
+	++du_pending;
+	pthread_cond_signal(&du_work_cond);
+	return TRUE;
+}
+
+/* Hand a subdirectory over to an idle worker, so one huge child is walked in parallel */
+static bool du_split(const du_job *job, const FTSENT *node)
+{
+	bool split = FALSE;
+
+	pthread_mutex_lock(&du_mutex);
+	if (du_idle > du_queued)
+		split = du_push(node->fts_path, job->entnum, job->mntpoint, TRUE);
+	pthread_mutex_unlock(&du_mutex);
+
+	return split;
+}
+
+/*
+ * Every dir of the subtree is read, but the entries of a dir are only stat'ed if
+ * its cached usage is missing or outdated (s. du_cache_get()). Sizes of files
+ * modified in place are thus picked up once their dir changes. Dirs with hard
+ * links are not cached, their usage depends on which dir counted a link first.
+ */
+static void du_walk(const du_job *job, blkcnt_t *pblocks, ullong_t *pfiles)
+{
+	char *path[2] = {(char *)job->path, NULL};
 	ullong_t tfiles = 0;
 	blkcnt_t tblocks = 0;
-	struct stat *sb;
-	FTS *tree = fts_open(path, FTS_PHYSICAL | FTS_XDEV | FTS_NOCHDIR, 0);
-	FTSENT *node;
+	dev_t dev = 0;
+	struct stat sbuf, *sb;
+	du_cent *own = NULL; /* Own usage of the dirs on the current path */
+	bool *cached = NULL;
+	bool *linked = NULL;
+	int nlevels = 0;
+	FTS *tree = fts_open(path, FTS_PHYSICAL | FTS_XDEV | FTS_NOCHDIR | FTS_NOSTAT, 0);
+	FTSENT *node, *skipped = NULL;
+	short level;
+
+	if (!tree)
+		return;
 
 	while ((node = fts_read(tree))) {
-		if (node->fts_info & FTS_D) {
+		level = node->fts_level;
+
+		if (node->fts_info == FTS_D) {
 			if (g_state.interrupt)
 				break;
+
+			if (level == FTS_ROOTLEVEL)
+				dev = node->fts_dev;
+			else if (node->fts_dev == dev && du_split(job, node)) {
+				fts_set(tree, node, FTS_SKIP);
+				skipped = node;
+				continue;
+			}
+
+			if (level >= nlevels) {
+				nlevels = level + 32;
+				own = xrealloc(own, nlevels * sizeof(du_cent));
+				cached = xrealloc(cached, nlevels * sizeof(bool));
+				linked = xrealloc(linked, nlevels * sizeof(bool));
+				if (!own || !cached || !linked)
+					break;
+			}
+
+			/*
+			 * fts stats dirs even with FTS_NOSTAT, but keeps only fts_dev,
+			 * fts_ino and fts_nlink, fts_statp is not allocated
+			 */
+			if (fstatat(AT_FDCWD, node->fts_accpath, &sbuf, AT_SYMLINK_NOFOLLOW) == -1) {
+				memset(&own[level], 0, sizeof(du_cent));
+				own[level].files = 1;
+				cached[level] = TRUE; /* Neither stat the entries nor cache it */
+				continue;
+			}
+
+			du_cent_init(&own[level], &sbuf);
+			cached[level] = du_cache_get(&own[level]);
+			linked[level] = FALSE;
 			continue;
 		}
 
-		sb = node->fts_statp;
+		if (node->fts_info == FTS_DP) {
+			/* The split dir comes back as FTS_DP right away, its own job counts it */
+			if (node == skipped) {
+				skipped = NULL;
+				continue;
+			}
 
-		if (cfg.apparentsz) {
-			if (sb->st_size && DU_TEST)
-				tblocks += sb->st_size;
-		} else if (sb->st_blocks && DU_TEST)
-			tblocks += sb->st_blocks;
+			/* Mount points are not descended, do not cache them */
+			if (!cached[level] && !linked[level] && own[level].dev == dev)
+				du_cache_put(&own[level]);
 
-		++tfiles;
+			tblocks += cfg.apparentsz ? own[level].size : own[level].blocks;
+			tfiles += own[level].files;
+			continue;
+		}
+
+		if (level == FTS_ROOTLEVEL || cached[level - 1])
+			continue;
+
+		/* Unreadable dir or stat failure, no usage known */
+		if (node->fts_info == FTS_DNR || node->fts_info == FTS_DC
+		    || node->fts_info == FTS_ERR || node->fts_info == FTS_NS)
+			sb = NULL;
+		else if (fstatat(AT_FDCWD, node->fts_accpath, &sbuf, AT_SYMLINK_NOFOLLOW) == -1)
+			continue;
+		else
+			sb = &sbuf;
+
+		/* Do not recount hard links */
+		if (sb && sb->st_nlink > 1)
+			linked[level - 1] = TRUE;
+		if (sb && (sb->st_nlink <= 1 || test_set_bit((uint_t)sb->st_ino))) {
+			own[level - 1].blocks += sb->st_blocks;
+			own[level - 1].size += sb->st_size;
+		}
+
+		++own[level - 1].files;
 	}
 
 	fts_close(tree);
+	free(own);
+	free(cached);
+	free(linked);
 
-	if (pdata->entnum >= 0)
-		pdents[pdata->entnum].blocks = tblocks;
+	*pblocks = tblocks;
+	*pfiles = tfiles;
+}
 
-	if (!pdata->mntpoint) {
-		core_blocks[pdata->core] += tblocks;
-		core_files[pdata->core] += tfiles;
-	} else
-		core_files[pdata->core] += 1;
+static void *du_thread(void *arg)
+{
+	du_job *job;
+	blkcnt_t tblocks;
+	ullong_t tfiles;
+
+	(void) arg;
+
+	pthread_mutex_lock(&du_mutex);
+	while (TRUE) {
+		while (!du_head) {
+			++du_idle;
+			pthread_cond_wait(&du_work_cond, &du_mutex);
+			--du_idle;
+		}
 
-	pthread_mutex_lock(&running_mutex);
-	threadbmp |= (1 << pdata->core);
-	--active_threads;
-	pthread_mutex_unlock(&running_mutex);
+		job = du_head;
+		du_head = job->next;
+		if (!du_head)
+			du_tail = NULL;
+		--du_queued;
+		pthread_mutex_unlock(&du_mutex);
+
+		tblocks = 0;
+		tfiles = 0;
+		/* Drain the queue without walking on interrupt */
+		if (!g_state.interrupt)
+			du_walk(job, &tblocks, &tfiles);
+
+		pthread_mutex_lock(&du_mutex);
+		if (job->entnum >= 0)
+			pdents[job->entnum].blocks += tblocks;
+
+		if (!job->mntpoint) {
+			du_blocks += tblocks;
+			du_files += tfiles;
+		} else if (!job->split)
+			++du_files;
+
+		--du_pending;
+		pthread_cond_broadcast(&du_done_cond);
+		free(job);
+	}
 
 	return NULL;
 }
 
-static void dirwalk(char *path, int entnum, bool mountpoint)
+/* Wait till all queued jobs are finished */
+static void du_wait(void)
 {
-	/* Loop till any core is free */
-	while (active_threads == NUM_DU_THREADS);
+	pthread_mutex_lock(&du_mutex);
+	while (du_pending)
+		pthread_cond_wait(&du_done_cond, &du_mutex);
+	pthread_mutex_unlock(&du_mutex);
+}
 
+static void dirwalk(char *path, int entnum, bool mountpoint)
+{
 	if (g_state.interrupt)
 		return;
 
-	pthread_mutex_lock(&running_mutex);
-	int core = ffs(threadbmp) - 1;
-
-	threadbmp &= ~(1 << core);
-	++active_threads;
-	pthread_mutex_unlock(&running_mutex);
+	pthread_mutex_lock(&du_mutex);
+	/* Wait for the workers to catch up instead of queueing without bounds */
+	while (du_queued >= num_du_threads * DU_JOBS_PER_THREAD)
+		pthread_cond_wait(&du_done_cond, &du_mutex);
 
-	xstrsncpy(core_data[core].path, path, PATH_MAX);
-	core_data[core].entnum = entnum;
-	core_data[core].core = (ushort_t)core;
-	core_data[core].mntpoint = mountpoint;
+	bool queued = du_push(path, entnum, mountpoint, FALSE);
 
-	pthread_t tid = 0;
+	pthread_mutex_unlock(&du_mutex);
 
-	pthread_create(&tid, NULL, du_thread, (void *)&(core_data[core]));
+	if (!queued)
+		return;
 
 	tolastln();
 	addstr(xbasename(path));
@@ -5866,20 +6179,27 @@ static void dirwalk(char *path, int entnum, bool mountpoint)
 	refresh();
 }
 
+/* Start the du workers, NNN_DU_THREADS or one per online CPU */
 static bool prep_threads(void)
 {
 	if (!g_state.duinit) {
-		/* drop MSB 1s */
-		threadbmp >>= (32 - NUM_DU_THREADS);
-
-		if (!core_blocks)
-			core_blocks = calloc(NUM_DU_THREADS, sizeof(blkcnt_t));
-		if (!core_data)
-			core_data = calloc(NUM_DU_THREADS, sizeof(thread_data));
-		if (!core_files)
-			core_files = calloc(NUM_DU_THREADS, sizeof(ullong_t));
-
-		if (!core_blocks || !core_data || !core_files) {
+		char *env = xgetenv("NNN_DU_THREADS", NULL);
+		long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+		pthread_attr_t attr;
+		pthread_t tid;
+
+		if (n < 1)
+			n = 1;
+		else if (n > DU_MAX_THREADS)
+			n = DU_MAX_THREADS;
+
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		while (num_du_threads < n && !pthread_create(&tid, &attr, du_thread, NULL))
+			++num_du_threads;
+		pthread_attr_destroy(&attr);
+
+		if (!num_du_threads) {
 			printwarn(NULL);
 			return FALSE;
 		}
@@ -5887,12 +6207,12 @@ static bool prep_threads(void)
 		/* Increase current open file descriptor limit */
 		max_openfds();
 #endif
+		du_cache_load();
 		g_state.duinit = TRUE;
-	} else {
-		memset(core_blocks, 0, NUM_DU_THREADS * sizeof(blkcnt_t));
-		memset(core_data, 0, NUM_DU_THREADS * sizeof(thread_data));
-		memset(core_files, 0, NUM_DU_THREADS * sizeof(ullong_t));
 	}
+
+	du_blocks = 0;
+	du_files = 0;
 	return TRUE;
 }
 
@@ -6015,7 +6335,7 @@ static int dentfill(char *path, struct entry **ppdents)
 
 		if (ndents == total_dents) {
 			if (cfg.blkorder)
-				while (active_threads);
+				du_wait();
 
 			total_dents += ENTRY_INCR;
 			*ppdents = xrealloc(*ppdents, total_dents * sizeof(**ppdents));
@@ -6115,6 +6435,7 @@ static int dentfill(char *path, struct entry **ppdents)
 				mkpath(path, namep, buf); // NOLINT
 
 				/* Need to show the disk usage of this dir */
+				dentp->blocks = 0;
 				dirwalk(buf, ndents, (sb_path.st_dev != sb.st_dev)); // NOLINT
 
 				if (g_state.interrupt)
@@ -6149,13 +6470,11 @@ static int dentfill(char *path, struct entry **ppdents)
 
 exit:
 	if (g_state.duinit && cfg.blkorder) {
-		while (active_threads);
+		du_wait();
 
 		attroff(COLOR_PAIR(cfg.curctx + 1));
-		for (int i = 0; i < NUM_DU_THREADS; ++i) {
-			num_files += core_files[i];
-			dir_blocks += core_blocks[i];
-		}
+		num_files += du_files;
+		dir_blocks += du_blocks;
 	}
 
 	/* Should never be null */
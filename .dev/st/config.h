@@ -36,6 +36,19 @@ static float chscale = 1.0;
  */
 wchar_t* worddelimiters = L" ";
 
+/*
+ * URL and file:line hints (TERMMOD+U). Lines are indexed as they are
+ * committed, so the hints of the visible screen show up instantly.
+ * urlprefixes start an URL. The selected hint is opened by running urlcmd
+ * or pathcmd through /bin/sh -c, with the match in $1 and, for file:line
+ * matches, the file in $2 and the line in $3. Labels use hintkeys.
+ */
+char* urlprefixes[] = { "https://", "http://", "ftp://", "file://",
+                        "mailto:", NULL };
+char* urlcmd = "xdg-open \"$1\"";
+char* pathcmd = "st -e nvim +\"$3\" \"$2\"";
+static char* hintkeys = "asdfghjklqwertyuiopzxcvbnm";
+
 /* selection timeouts (in milliseconds) */
 static unsigned int doubleclicktimeout = 300;
 static unsigned int tripleclicktimeout = 600;
@@ -56,6 +69,13 @@ int allowwindowops = 0;
 static double minlatency = 2;
 static double maxlatency = 33;
 
+/*
+ * worker threads used to build the glyph specs of the dirty rows when many
+ * of them are redrawn at once (resize, zoom, full screen output). 0 draws
+ * everything from the main thread.
+ */
+static int drawthreads = 4;
+
 /*
  * blinking timeout (set to 0 to disable blinking) for the terminal blinking
  * attribute.
@@ -218,6 +238,7 @@ static Shortcut shortcuts[] = {
     { TERMMOD, XK_Y, selpaste, { .i = 0 } },
     { ShiftMask, XK_Insert, selpaste, { .i = 0 } },
     { TERMMOD, XK_Num_Lock, numlock, { .i = 0 } },
+    { TERMMOD, XK_U, hintstart, { .i = 0 } },
     { ShiftMask, XK_Page_Up, kscrollup, { .i = -1 } },
     { ShiftMask, XK_Page_Down, kscrolldown, { .i = -1 } },
 };
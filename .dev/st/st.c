@@ -14,6 +14,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <wchar.h>
 
@@ -36,6 +37,8 @@
 #define STR_BUF_SIZ   ESC_BUF_SIZ
 #define STR_ARG_SIZ   ESC_ARG_SIZ
 #define HISTSIZE      2000
+#define REC_MAGIC     "stR1"
+#define REC_HDRSIZ    20
 
 /* macros */
 #define IS_SET(flag)		((term.mode & (flag)) != 0)
@@ -137,6 +140,19 @@ typedef struct {
 	Rune lastc;   /* last printed char outside of sequence, 0 if control */
 } Term;
 
+/* URL and file:line index, see urlscan() */
+typedef struct {
+	ushort x1, x2; /* first and last column */
+	uchar type;    /* hint_type */
+} Urlspan;
+
+typedef struct {
+	Line line;     /* indexed line, NULL if free */
+	uint32_t sum;  /* hash of the runes when it was scanned */
+	int n;         /* number of spans */
+	Urlspan *span;
+} Urlentry;
+
 /* CSI Escape sequence structs */
 /* ESC '[' [[ [<priv>] <arg> [;]] <mode> [<mode>]] */
 typedef struct {
@@ -163,6 +179,11 @@ static void execsh(char *, char **);
 static void stty(char **);
 static void sigchld(int);
 static void ttywriteraw(const char *, size_t);
+static void ttyrecwrite(const char *, size_t);
+static int ttyreplaynew(void);
+static void ttyreplayer(FILE *, int);
+static size_t putvarint(uchar *, uint64_t);
+static int getvarint(FILE *, uint64_t *);
 
 static void csidump(void);
 static void csihandle(void);
@@ -211,6 +232,12 @@ static void tstrsequence(uchar);
 
 static void drawregion(int, int, int, int);
 
+static void urlreset(void);
+static Urlentry *urlentry(Line);
+static Urlentry *urlscan(Line);
+static void urladd(Urlentry *, int, int, int);
+static int urlprefix(Line, int, int);
+
 static void selnormalize(void);
 static void selscroll(int, int);
 static void selsnap(int *, int *, int);
@@ -228,11 +255,17 @@ static ssize_t xwrite(int, const char *, size_t);
 /* Globals */
 static Term term;
 static Selection sel;
+static Urlentry *urlidx;
+static size_t urlidxsiz;
 static CSIEscape csiescseq;
 static STREscape strescseq;
 static int iofd = 1;
 static int cmdfd;
 static pid_t pid;
+static int recfd = -1;
+static struct timespec rects;
+static const char *replayfile;
+static int replaypaced;
 
 static const uchar utfbyte[UTF_SIZ + 1] = {0x80,    0, 0xC0, 0xE0, 0xF0};
 static const uchar utfmask[UTF_SIZ + 1] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
@@ -774,6 +807,9 @@ ttynew(const char *line, char *cmd, const char *out, char **args)
 		}
 	}
 
+	if (replayfile)
+		return ttyreplaynew();
+
 	if (line) {
 		if ((cmdfd = open(line, O_RDWR)) < 0)
 			die("open line '%s' failed: %s\n",
@@ -837,6 +873,8 @@ ttyread(void)
 	case -1:
 		die("couldn't read from shell: %s\n", strerror(errno));
 	default:
+		if (recfd >= 0)
+			ttyrecwrite(buf + buflen, ret);
 		buflen += ret;
 		written = twrite(buf, buflen, 0);
 		buflen -= written;
@@ -885,6 +923,10 @@ ttywriteraw(const char *s, size_t n)
 	ssize_t r;
 	size_t lim = 256;
 
+	/* there is nobody to answer to while replaying */
+	if (replayfile)
+		return;
+
 	/*
 	 * Remember that we are using a pty, which might be a modem line.
 	 * Writing too much will clog the line. That's why we are doing this
@@ -940,6 +982,9 @@ ttyresize(int tw, int th)
 {
 	struct winsize w;
 
+	if (replayfile)
+		return;
+
 	w.ws_row = term.row;
 	w.ws_col = term.col;
 	w.ws_xpixel = tw;
@@ -955,6 +1000,141 @@ ttyhangup(void)
 	kill(pid, SIGHUP);
 }
 
+/*
+ * Recording format: the REC_MAGIC header followed by one record per
+ * ttyread(), each made of the delay in microseconds since the previous
+ * record and the data length as LEB128 varints, then the data itself.
+ */
+size_t
+putvarint(uchar *p, uint64_t v)
+{
+	size_t n = 0;
+
+	do {
+		p[n++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+		v >>= 7;
+	} while (v);
+
+	return n;
+}
+
+int
+getvarint(FILE *fp, uint64_t *v)
+{
+	int c, shift;
+
+	for (*v = 0, shift = 0; shift < 64; shift += 7) {
+		if ((c = getc(fp)) == EOF)
+			return 0;
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return 1;
+	}
+
+	return 0;
+}
+
+void
+ttyrecord(const char *path)
+{
+	if ((recfd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+		die("open record file '%s' failed: %s\n", path, strerror(errno));
+	if (xwrite(recfd, REC_MAGIC, sizeof(REC_MAGIC) - 1) < 0)
+		die("write error on record file: %s\n", strerror(errno));
+	clock_gettime(CLOCK_MONOTONIC, &rects);
+}
+
+void
+ttyrecwrite(const char *s, size_t n)
+{
+	static uchar buf[REC_HDRSIZ + BUFSIZ];
+	struct timespec now;
+	uint64_t delay;
+	size_t len;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	delay = (now.tv_sec - rects.tv_sec) * 1000000 +
+	        (now.tv_nsec - rects.tv_nsec) / 1000;
+	rects = now;
+
+	/* one write per record, so nothing is lost if st dies */
+	len = putvarint(buf, delay);
+	len += putvarint(buf + len, n);
+	memcpy(buf + len, s, n);
+	if (xwrite(recfd, (char *)buf, len + n) < 0) {
+		fprintf(stderr, "write error on record file: %s\n",
+		        strerror(errno));
+		close(recfd);
+		recfd = -1;
+	}
+}
+
+void
+ttyreplay(const char *path, int paced)
+{
+	replayfile = path;
+	replaypaced = paced;
+}
+
+void
+ttyreplayer(FILE *fp, int fd)
+{
+	static char buf[BUFSIZ];
+	uint64_t delay, n;
+	struct timespec ts;
+
+	while (getvarint(fp, &delay) && getvarint(fp, &n)) {
+		if (n > sizeof(buf) || fread(buf, 1, n, fp) != n)
+			die("corrupt record file '%s'\n", replayfile);
+		if (replaypaced && delay) {
+			ts.tv_sec = delay / 1000000;
+			ts.tv_nsec = (delay % 1000000) * 1000;
+			while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+				;
+		}
+		if (xwrite(fd, buf, n) < 0)
+			die("write error on replay pipe: %s\n", strerror(errno));
+	}
+}
+
+int
+ttyreplaynew(void)
+{
+	char magic[sizeof(REC_MAGIC) - 1];
+	FILE *fp;
+	int fds[2];
+
+	if (!(fp = fopen(replayfile, "r")))
+		die("open record file '%s' failed: %s\n",
+		    replayfile, strerror(errno));
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+	    memcmp(magic, REC_MAGIC, sizeof(magic)))
+		die("'%s' is not a st record file\n", replayfile);
+	if (pipe(fds) < 0)
+		die("pipe failed: %s\n", strerror(errno));
+
+	/*
+	 * The recorded stream is fed by a child through a pipe, so it goes
+	 * through ttyread() and twrite() exactly like the output of a shell.
+	 * st exits on EOF once everything has been processed.
+	 */
+	switch (pid = fork()) {
+	case -1:
+		die("fork failed: %s\n", strerror(errno));
+		break;
+	case 0:
+		close(fds[0]);
+		ttyreplayer(fp, fds[1]);
+		_exit(0);
+	default:
+		fclose(fp);
+		close(fds[1]);
+		cmdfd = fds[0];
+		break;
+	}
+	return cmdfd;
+}
+
 int
 tattrset(int attr)
 {
@@ -1138,6 +1318,7 @@ tscrollup(int orig, int n, int copyhist)
 		temp = term.hist[term.histi];
 		term.hist[term.histi] = term.line[orig];
 		term.line[orig] = temp;
+		urlscan(term.hist[term.histi]);
 	}
 
 	if (term.scr > 0 && term.scr < HISTSIZE)
@@ -1181,6 +1362,7 @@ tnewline(int first_col)
 {
 	int y = term.c.y;
 
+	urlscan(term.line[y]);
 	if (y == term.bot) {
 		tscrollup(term.top, 1, 1);
 	} else {
@@ -2715,6 +2897,198 @@ tresize(int col, int row)
 		tcursor(CURSOR_LOAD);
 	}
 	term.c = c;
+	/* lines were reallocated */
+	urlreset();
+}
+
+void
+urlreset(void)
+{
+	size_t i;
+
+	for (i = 0; i < urlidxsiz; i++)
+		free(urlidx[i].span);
+
+	/* every line of the screens and history fits at half load */
+	for (urlidxsiz = 64; urlidxsiz < 2 * (HISTSIZE + 2 * term.row);)
+		urlidxsiz *= 2;
+	urlidx = xrealloc(urlidx, urlidxsiz * sizeof(*urlidx));
+	memset(urlidx, 0, urlidxsiz * sizeof(*urlidx));
+}
+
+Urlentry *
+urlentry(Line line)
+{
+	size_t i = ((uintptr_t)line >> 4) * 2654435761u & (urlidxsiz - 1);
+
+	while (urlidx[i].line && urlidx[i].line != line)
+		i = (i + 1) & (urlidxsiz - 1);
+
+	return &urlidx[i];
+}
+
+void
+urladd(Urlentry *e, int x1, int x2, int type)
+{
+	e->span = xrealloc(e->span, (e->n + 1) * sizeof(*e->span));
+	e->span[e->n++] = (Urlspan){ x1, x2, type };
+}
+
+int
+urlprefix(Line line, int x, int len)
+{
+	char **p;
+	int i;
+
+	for (p = urlprefixes; *p; p++) {
+		for (i = 0; (*p)[i] && x + i < len; i++) {
+			if (line[x + i].u != (uchar)(*p)[i])
+				break;
+		}
+		if (!(*p)[i])
+			return i;
+	}
+
+	return 0;
+}
+
+#define ISURLCHAR(u)	((u) > ' ' && (u) != 0x7f && \
+			 !((u) < 0x80 && strchr("<>\"'`{}|\\^", (u))))
+#define ISPATHCHAR(u)	(BETWEEN((u), 'a', 'z') || BETWEEN((u), 'A', 'Z') || \
+			 BETWEEN((u), '0', '9') || \
+			 ((u) && (u) < 0x80 && strchr("_./~+-@", (u))))
+#define ISDIGIT(u)	BETWEEN((u), '0', '9')
+
+/*
+ * Index the URLs and file:line[:col] references of a line. Lines are
+ * scanned again only when their content changed since the last scan.
+ */
+Urlentry *
+urlscan(Line line)
+{
+	Urlentry *e;
+	uint32_t sum = 2166136261u;
+	int x, s, n, len = term.col, open, close, haspath;
+
+	for (x = 0; x < len; x++)
+		sum = (sum ^ line[x].u) * 16777619u;
+
+	e = urlentry(line);
+	if (e->line == line && e->sum == sum)
+		return e;
+	e->line = line;
+	e->sum = sum;
+	e->n = 0;
+
+	for (x = 0; x < len;) {
+		if ((n = urlprefix(line, x, len))) {
+			for (open = close = 0, s = x + n; s < len &&
+			     ISURLCHAR(line[s].u); s++) {
+				open += line[s].u == '(';
+				close += line[s].u == ')';
+			}
+			/* leave out trailing punctuation, but keep (...) */
+			while (s > x + n && line[s-1].u < 0x80 &&
+			       strchr(".,;:!?)]}'\"", line[s-1].u)) {
+				if (line[s-1].u == ')' && open >= close)
+					break;
+				close -= line[s-1].u == ')';
+				s--;
+			}
+			if (s > x + n)
+				urladd(e, x, s - 1, HINT_URL);
+			x = MAX(s, x + n);
+			continue;
+		}
+		if (!ISPATHCHAR(line[x].u)) {
+			x++;
+			continue;
+		}
+
+		/* file:line[:col] */
+		for (haspath = 0, s = x; s < len && ISPATHCHAR(line[s].u); s++)
+			haspath |= line[s].u == '.' || line[s].u == '/';
+		if (haspath && s + 1 < len && line[s].u == ':' &&
+		    ISDIGIT(line[s+1].u)) {
+			for (s++; s < len && ISDIGIT(line[s].u); s++)
+				;
+			if (s + 1 < len && line[s].u == ':' &&
+			    ISDIGIT(line[s+1].u)) {
+				for (s++; s < len && ISDIGIT(line[s].u); s++)
+					;
+			}
+			urladd(e, x, s - 1, HINT_PATH);
+		}
+		x = s;
+	}
+
+	return e;
+}
+
+int
+hintcollect(Hint *h, int max)
+{
+	Urlentry *e;
+	int y, i, n = 0;
+
+	for (y = 0; y < term.row && n < max; y++) {
+		e = urlscan(TLINE(y));
+		for (i = 0; i < e->n && n < max; i++, n++) {
+			h[n] = (Hint){ e->span[i].x1, e->span[i].x2, y,
+			               e->span[i].type };
+		}
+	}
+
+	return n;
+}
+
+void
+hintopen(const Hint *h)
+{
+	Line line;
+	char *s, *file = NULL, *lnum = NULL, *p;
+	size_t len = 0;
+	pid_t child;
+	int x;
+
+	if (h->y >= term.row || h->x2 >= term.col)
+		return;
+	line = TLINE(h->y);
+
+	s = xmalloc((h->x2 - h->x1 + 1) * UTF_SIZ + 1);
+	for (x = h->x1; x <= h->x2; x++)
+		len += utf8encode(line[x].u, s + len);
+	s[len] = '\0';
+
+	if (h->type == HINT_PATH) {
+		file = xstrdup(s);
+		lnum = strchr(file, ':');
+		*lnum++ = '\0';
+		if ((p = strchr(lnum, ':')))
+			*p = '\0';
+	}
+
+	/* double fork, so the command is not left as a zombie */
+	switch (child = fork()) {
+	case -1:
+		fprintf(stderr, "fork failed: %s\n", strerror(errno));
+		break;
+	case 0:
+		close(cmdfd);
+		if (fork() == 0) {
+			setsid();
+			execl("/bin/sh", "sh", "-c",
+			      h->type == HINT_URL ? urlcmd : pathcmd,
+			      "sh", s, file, lnum, (char *)NULL);
+			_exit(1);
+		}
+		_exit(0);
+	default:
+		waitpid(child, NULL, 0);
+		break;
+	}
+	free(file);
+	free(s);
 }
 
 void
@@ -2726,15 +3100,24 @@ resettitle(void)
 void
 drawregion(int x1, int y1, int x2, int y2)
 {
+	static Line *lines;
+	static int linesiz;
 	int y;
 
+	if (linesiz < y2) {
+		linesiz = y2;
+		lines = xrealloc(lines, linesiz * sizeof(Line));
+	}
+
 	for (y = y1; y < y2; y++) {
+		lines[y] = NULL;
 		if (!term.dirty[y])
 			continue;
 
 		term.dirty[y] = 0;
-		xdrawline(TLINE(y), x1, y, x2);
+		lines[y] = TLINE(y);
 	}
+	xdrawlines(lines, x1, y1, x2, y2);
 }
 
 void
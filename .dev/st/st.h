@@ -69,6 +69,17 @@ typedef struct {
 
 typedef Glyph *Line;
 
+enum hint_type {
+	HINT_URL,
+	HINT_PATH
+};
+
+typedef struct {
+	int x1, x2;       /* first and last column */
+	int y;
+	int type;
+} Hint;
+
 typedef union {
 	int i;
 	uint ui;
@@ -95,6 +106,8 @@ void tsetdirtattr(int);
 void ttyhangup(void);
 int ttynew(const char *, char *, const char *, char **);
 size_t ttyread(void);
+void ttyrecord(const char *);
+void ttyreplay(const char *, int);
 void ttyresize(int, int);
 void ttywrite(const char *, size_t, int);
 
@@ -107,6 +120,9 @@ void selextend(int, int, int, int);
 int selected(int, int);
 char *getsel(void);
 
+int hintcollect(Hint *, int);
+void hintopen(const Hint *);
+
 size_t utf8encode(Rune, char *);
 
 void *xmalloc(size_t);
@@ -119,6 +135,9 @@ extern char *scroll;
 extern char *stty_args;
 extern char *vtiden;
 extern wchar_t *worddelimiters;
+extern char *urlprefixes[];
+extern char *urlcmd;
+extern char *pathcmd;
 extern int allowaltscreen;
 extern int allowwindowops;
 extern char *termname;
@@ -3,7 +3,9 @@
 #include <math.h>
 #include <limits.h>
 #include <locale.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdint.h>
 #include <sys/select.h>
 #include <time.h>
 #include <unistd.h>
@@ -59,6 +61,7 @@ static void zoom(const Arg *);
 static void zoomabs(const Arg *);
 static void zoomreset(const Arg *);
 static void ttysend(const Arg *);
+static void hintstart(const Arg *);
 
 /* config.h for applying patches and the configuration. */
 #include "config.h"
@@ -94,6 +97,7 @@ typedef struct {
 	Window win;
 	Drawable buf;
 	GlyphFontSpec *specbuf; /* font spec buffer used for rendering */
+	int *specnum; /* number of specs built per row, -1 on cache miss */
 	Atom xembed, wmdeletewin, netwmname, netwmiconname, netwmpid;
 	struct {
 		XIM xim;
@@ -143,7 +147,18 @@ typedef struct {
 } DC;
 
 static inline ushort sixd_to_16bit(int);
+static Font *xmodefont(ushort, int *);
+static void xcacheglyph(Rune, int, XftFont *, FT_UInt);
 static int xmakeglyphfontspecs(XftGlyphFontSpec *, const Glyph *, int, int, int);
+static int xcachedglyphfontspecs(XftGlyphFontSpec *, const Glyph *, int, int, int);
+static void *xspecworker(void *);
+static void xspecrows(int);
+static int xspecpoolinit(void);
+static void xdrawspecline(Line, XftGlyphFontSpec *, int, int, int, int);
+static void hintlabel(int, char *);
+static void hintkey(KeySym, const char *, int);
+static void hintstop(void);
+static void xdrawhints(void);
 static void xdrawglyphfontspecs(const XftGlyphFontSpec *, Glyph, int, int, int);
 static void xdrawglyph(Glyph, int, int);
 static void xclear(int, int, int, int);
@@ -223,6 +238,15 @@ static XWindow xw;
 static XSelection xsel;
 static TermWindow win;
 
+/* URL and file:line hint mode */
+static struct {
+	Hint *hints;
+	int n;
+	int active;
+	char keys[2]; /* label typed so far */
+	int nkeys;
+} hint;
+
 /* Font Ring Cache */
 enum {
 	FRC_NORMAL,
@@ -241,6 +265,44 @@ typedef struct {
 static Fontcache *frc = NULL;
 static int frclen = 0;
 static int frccap = 0;
+/*
+ * Glyph lookup cache. It is only written from the main thread and read by
+ * the spec workers, which leave any row with a miss to the main thread.
+ */
+#define GCACHESIZ	4096
+#define GCACHEIDX(u, f)	(((u) * 4 + (f)) & (GCACHESIZ - 1))
+
+typedef struct {
+	Rune unicodep;
+	int flags;
+	XftFont *font;
+	FT_UInt glyph;
+} Glyphcache;
+
+static Glyphcache gcache[GCACHESIZ];
+
+/* Spec worker pool, used when many rows are dirty at once */
+#define SPECMINROWS	16
+
+typedef struct {
+	Line *lines;
+	int x1, y1, x2, y2;
+} SpecJob;
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	unsigned long gen;
+	int nthreads;
+	int pending;
+	int ready;
+	SpecJob job;
+} specpool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.start = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
 static char *usedfont = NULL;
 static double usedfontsize = 0;
 static double defaultfontsize = 0;
@@ -331,6 +393,89 @@ ttysend(const Arg *arg)
 	ttywrite(arg->s, strlen(arg->s), 1);
 }
 
+void
+hintstart(const Arg *dummy)
+{
+	int nkeys = strlen(hintkeys);
+
+	if (!hint.hints)
+		hint.hints = xmalloc(nkeys * nkeys * sizeof(Hint));
+	if (!(hint.n = hintcollect(hint.hints, nkeys * nkeys)))
+		return;
+	hint.active = 1;
+	hint.nkeys = 0;
+	redraw();
+}
+
+void
+hintlabel(int i, char *label)
+{
+	int nkeys = strlen(hintkeys);
+
+	if (hint.n <= nkeys) {
+		label[0] = hintkeys[i];
+	} else {
+		label[0] = hintkeys[i / nkeys];
+		label[1] = hintkeys[i % nkeys];
+	}
+}
+
+void
+hintkey(KeySym ksym, const char *buf, int len)
+{
+	int i, labellen = (hint.n <= strlen(hintkeys)) ? 1 : 2;
+	char label[2];
+
+	if (len == 0 && ksym != XK_Escape)
+		return; /* modifiers */
+	if (len != 1 || ksym == XK_Escape) {
+		hintstop();
+		return;
+	}
+
+	hint.keys[hint.nkeys++] = buf[0];
+	for (i = 0; i < hint.n; i++) {
+		hintlabel(i, label);
+		if (memcmp(label, hint.keys, hint.nkeys))
+			continue;
+		if (hint.nkeys == labellen) {
+			hintstop();
+			hintopen(&hint.hints[i]);
+		} else {
+			redraw();
+		}
+		return;
+	}
+	hintstop(); /* no label starts with what was typed */
+}
+
+void
+hintstop(void)
+{
+	hint.active = 0;
+	redraw();
+}
+
+void
+xdrawhints(void)
+{
+	Glyph g = { .mode = ATTR_REVERSE | ATTR_BOLD,
+	            .fg = defaultfg, .bg = defaultbg };
+	int i, j, labellen = (hint.n <= strlen(hintkeys)) ? 1 : 2;
+	char label[2];
+
+	for (i = 0; i < hint.n; i++) {
+		hintlabel(i, label);
+		if (memcmp(label, hint.keys, hint.nkeys))
+			continue;
+		for (j = 0; j < labellen; j++) {
+			g.u = label[j];
+			xdrawglyph(g, MIN(hint.hints[i].x1 + j,
+			           hint.hints[i].x2), hint.hints[i].y);
+		}
+	}
+}
+
 int
 evcol(XEvent *e)
 {
@@ -460,6 +605,8 @@ mouseaction(XEvent *e, uint release)
 		    ms->button == e->xbutton.button &&
 		    (match(ms->mod, state) ||  /* exact or forced */
 		     match(ms->mod, state & ~forcemousemod))) {
+			if (hint.active)
+				hintstop(); /* e.g. kscrollup moves the spans */
 			ms->func(&(ms->arg));
 			return 1;
 		}
@@ -742,6 +889,8 @@ cresize(int width, int height)
 	col = MAX(1, col);
 	row = MAX(1, row);
 
+	if (hint.active)
+		hintstop();
 	tresize(col, row);
 	xresize(col, row);
 	ttyresize(win.tw, win.th);
@@ -759,8 +908,9 @@ xresize(int col, int row)
 	XftDrawChange(xw.draw, xw.buf);
 	xclear(0, 0, win.w, win.h);
 
-	/* resize to new width */
-	xw.specbuf = xrealloc(xw.specbuf, col * sizeof(GlyphFontSpec));
+	/* resize to new size, one spec row per terminal row */
+	xw.specbuf = xrealloc(xw.specbuf, col * row * sizeof(GlyphFontSpec));
+	xw.specnum = xrealloc(xw.specnum, row * sizeof(int));
 }
 
 ushort
@@ -1079,6 +1229,7 @@ xunloadfonts(void)
 	/* Free the loaded fonts in the font cache.  */
 	while (frclen > 0)
 		XftFontClose(xw.dpy, frc[--frclen].font);
+	memset(gcache, 0, sizeof(gcache));
 
 	xunloadfont(&dc.font);
 	xunloadfont(&dc.bfont);
@@ -1213,7 +1364,8 @@ xinit(int cols, int rows)
 	XFillRectangle(xw.dpy, xw.buf, dc.gc, 0, 0, win.w, win.h);
 
 	/* font spec buffer */
-	xw.specbuf = xmalloc(cols * sizeof(GlyphFontSpec));
+	xw.specbuf = xmalloc(cols * rows * sizeof(GlyphFontSpec));
+	xw.specnum = xmalloc(rows * sizeof(int));
 
 	/* Xft rendering context */
 	xw.draw = XftDrawCreate(xw.dpy, xw.buf, xw.vis, xw.cmap);
@@ -1267,6 +1419,34 @@ xinit(int cols, int rows)
 		xsel.xtarget = XA_STRING;
 }
 
+Font *
+xmodefont(ushort mode, int *frcflags)
+{
+	if ((mode & ATTR_ITALIC) && (mode & ATTR_BOLD)) {
+		*frcflags = FRC_ITALICBOLD;
+		return &dc.ibfont;
+	} else if (mode & ATTR_ITALIC) {
+		*frcflags = FRC_ITALIC;
+		return &dc.ifont;
+	} else if (mode & ATTR_BOLD) {
+		*frcflags = FRC_BOLD;
+		return &dc.bfont;
+	}
+	*frcflags = FRC_NORMAL;
+	return &dc.font;
+}
+
+void
+xcacheglyph(Rune rune, int frcflags, XftFont *font, FT_UInt glyphidx)
+{
+	Glyphcache *gc = &gcache[GCACHEIDX(rune, frcflags)];
+
+	gc->unicodep = rune;
+	gc->flags = frcflags;
+	gc->font = font;
+	gc->glyph = glyphidx;
+}
+
 int
 xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x, int y)
 {
@@ -1295,25 +1475,15 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 		/* Determine font for glyph if different from previous glyph. */
 		if (prevmode != mode) {
 			prevmode = mode;
-			font = &dc.font;
-			frcflags = FRC_NORMAL;
+			font = xmodefont(mode, &frcflags);
 			runewidth = win.cw * ((mode & ATTR_WIDE) ? 2.0f : 1.0f);
-			if ((mode & ATTR_ITALIC) && (mode & ATTR_BOLD)) {
-				font = &dc.ibfont;
-				frcflags = FRC_ITALICBOLD;
-			} else if (mode & ATTR_ITALIC) {
-				font = &dc.ifont;
-				frcflags = FRC_ITALIC;
-			} else if (mode & ATTR_BOLD) {
-				font = &dc.bfont;
-				frcflags = FRC_BOLD;
-			}
 			yp = winy + font->ascent + win.cyo;
 		}
 
 		/* Lookup character index with default font. */
 		glyphidx = XftCharIndex(xw.dpy, font->match, rune);
 		if (glyphidx) {
+			xcacheglyph(rune, frcflags, font->match, glyphidx);
 			specs[numspecs].font = font->match;
 			specs[numspecs].glyph = glyphidx;
 			specs[numspecs].x = (short)xp;
@@ -1388,6 +1558,7 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 			FcCharSetDestroy(fccharset);
 		}
 
+		xcacheglyph(rune, frcflags, frc[f].font, glyphidx);
 		specs[numspecs].font = frc[f].font;
 		specs[numspecs].glyph = glyphidx;
 		specs[numspecs].x = (short)xp;
@@ -1399,6 +1570,118 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 	return numspecs;
 }
 
+/*
+ * Same as xmakeglyphfontspecs(), but only using the glyph cache, so it is
+ * safe to call from the spec workers. Returns -1 on the first cache miss.
+ */
+int
+xcachedglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x, int y)
+{
+	float winx = borderpx + x * win.cw, winy = borderpx + y * win.ch, xp, yp;
+	ushort mode, prevmode = USHRT_MAX;
+	Font *font = &dc.font;
+	int frcflags = FRC_NORMAL;
+	float runewidth = win.cw;
+	Glyphcache *gc;
+	int i, numspecs = 0;
+
+	for (i = 0, xp = winx, yp = winy + font->ascent + win.cyo; i < len; ++i) {
+		mode = glyphs[i].mode;
+
+		/* Skip dummy wide-character spacing. */
+		if (mode == ATTR_WDUMMY)
+			continue;
+
+		if (prevmode != mode) {
+			prevmode = mode;
+			font = xmodefont(mode, &frcflags);
+			runewidth = win.cw * ((mode & ATTR_WIDE) ? 2.0f : 1.0f);
+			yp = winy + font->ascent + win.cyo;
+		}
+
+		gc = &gcache[GCACHEIDX(glyphs[i].u, frcflags)];
+		if (!gc->font || gc->unicodep != glyphs[i].u
+				|| gc->flags != frcflags)
+			return -1;
+
+		specs[numspecs].font = gc->font;
+		specs[numspecs].glyph = gc->glyph;
+		specs[numspecs].x = (short)xp;
+		specs[numspecs].y = (short)yp;
+		xp += runewidth;
+		numspecs++;
+	}
+
+	return numspecs;
+}
+
+void
+xspecrows(int id)
+{
+	SpecJob *job = &specpool.job;
+	int y, stride = job->x2 - job->x1;
+
+	for (y = job->y1 + id; y < job->y2; y += specpool.nthreads + 1) {
+		if (!job->lines[y])
+			continue;
+		xw.specnum[y] = xcachedglyphfontspecs(
+				xw.specbuf + (y - job->y1) * stride,
+				&job->lines[y][job->x1], stride, job->x1, y);
+	}
+}
+
+void *
+xspecworker(void *arg)
+{
+	int id = (intptr_t)arg;
+	unsigned long gen = 0;
+
+	pthread_mutex_lock(&specpool.lock);
+	for (;;) {
+		while (specpool.gen == gen)
+			pthread_cond_wait(&specpool.start, &specpool.lock);
+		gen = specpool.gen;
+		pthread_mutex_unlock(&specpool.lock);
+
+		xspecrows(id);
+
+		pthread_mutex_lock(&specpool.lock);
+		if (--specpool.pending == 0)
+			pthread_cond_signal(&specpool.done);
+	}
+
+	return NULL;
+}
+
+int
+xspecpoolinit(void)
+{
+	pthread_t thread;
+	sigset_t set, oset;
+	int i;
+
+	if (specpool.ready)
+		return specpool.nthreads > 0;
+	specpool.ready = 1;
+
+	/* signals are handled by the main thread only */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oset);
+	for (i = 0; i < drawthreads; i++) {
+		if (pthread_create(&thread, NULL, xspecworker,
+				(void *)(intptr_t)(i + 1)) != 0) {
+			fprintf(stderr, "xspecpoolinit: pthread_create: %s\n",
+					strerror(errno));
+			break;
+		}
+		pthread_detach(thread);
+		specpool.nthreads++;
+	}
+	pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
+	return specpool.nthreads > 0;
+}
+
 void
 xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, int y)
 {
@@ -1697,11 +1980,64 @@ xstartdraw(void)
 void
 xdrawline(Line line, int x1, int y1, int x2)
 {
-	int i, x, ox, numspecs;
-	Glyph base, new;
+	int numspecs;
 	XftGlyphFontSpec *specs = xw.specbuf;
 
 	numspecs = xmakeglyphfontspecs(specs, &line[x1], x2 - x1, x1, y1);
+	xdrawspecline(line, specs, numspecs, x1, y1, x2);
+}
+
+void
+xdrawlines(Line *lines, int x1, int y1, int x2, int y2)
+{
+	int y, n, stride = x2 - x1;
+	XftGlyphFontSpec *specs;
+
+	for (n = 0, y = y1; y < y2; y++)
+		n += lines[y] != NULL;
+
+	if (n < SPECMINROWS || !xspecpoolinit()) {
+		for (y = y1; y < y2; y++) {
+			if (lines[y])
+				xdrawline(lines[y], x1, y, x2);
+		}
+		return;
+	}
+
+	/* build the specs of all dirty rows in parallel */
+	pthread_mutex_lock(&specpool.lock);
+	specpool.job = (SpecJob){ lines, x1, y1, x2, y2 };
+	specpool.pending = specpool.nthreads;
+	specpool.gen++;
+	pthread_cond_broadcast(&specpool.start);
+	pthread_mutex_unlock(&specpool.lock);
+
+	xspecrows(0);
+
+	pthread_mutex_lock(&specpool.lock);
+	while (specpool.pending > 0)
+		pthread_cond_wait(&specpool.done, &specpool.lock);
+	pthread_mutex_unlock(&specpool.lock);
+
+	/* submit in order, resolving cache misses on the main thread */
+	for (y = y1; y < y2; y++) {
+		if (!lines[y])
+			continue;
+		specs = xw.specbuf + (y - y1) * stride;
+		if (xw.specnum[y] < 0) {
+			xw.specnum[y] = xmakeglyphfontspecs(specs,
+					&lines[y][x1], stride, x1, y);
+		}
+		xdrawspecline(lines[y], specs, xw.specnum[y], x1, y, x2);
+	}
+}
+
+void
+xdrawspecline(Line line, XftGlyphFontSpec *specs, int numspecs, int x1, int y1, int x2)
+{
+	int i, x, ox;
+	Glyph base, new;
+
 	i = ox = 0;
 	for (x = x1; x < x2 && i < numspecs; x++) {
 		new = line[x];
@@ -1728,6 +2064,8 @@ xdrawline(Line line, int x1, int y1, int x2)
 void
 xfinishdraw(void)
 {
+	if (hint.active)
+		xdrawhints();
 	XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, 0, 0, win.w,
 			win.h, 0, 0);
 	XSetForeground(xw.dpy, dc.gc,
@@ -1902,6 +2240,12 @@ kpress(XEvent *ev)
 	} else {
 		len = XLookupString(e, buf, sizeof buf, &ksym, NULL);
 	}
+	/* 0. hint mode grabs the keyboard */
+	if (hint.active) {
+		hintkey(ksym, buf, len);
+		return;
+	}
+
 	/* 1. shortcuts */
 	for (bp = shortcuts; bp < shortcuts + LEN(shortcuts); bp++) {
 		if (ksym == bp->keysym && match(bp->mod, e->state)) {
@@ -2011,8 +2355,11 @@ run(void)
 		}
 		clock_gettime(CLOCK_MONOTONIC, &now);
 
-		if (FD_ISSET(ttyfd, &rfd))
-			ttyread();
+		if (FD_ISSET(ttyfd, &rfd)) {
+			/* the spans of the hints no longer match the screen */
+			if (ttyread() && hint.active)
+				hintstop();
+		}
 
 		xev = 0;
 		while (XPending(xw.dpy)) {
@@ -2075,12 +2422,16 @@ usage(void)
 {
 	die("usage: %s [-aiv] [-c class] [-f font] [-g geometry]"
 	    " [-n name] [-o file]\n"
-	    "          [-T title] [-t title] [-w windowid]"
+	    "          [-r file] [-T title] [-t title] [-w windowid]"
 	    " [[-e] command [args ...]]\n"
 	    "       %s [-aiv] [-c class] [-f font] [-g geometry]"
 	    " [-n name] [-o file]\n"
-	    "          [-T title] [-t title] [-w windowid] -l line"
-	    " [stty_args ...]\n", argv0, argv0);
+	    "          [-r file] [-T title] [-t title] [-w windowid] -l line"
+	    " [stty_args ...]\n"
+	    "       %s [-aiv] [-c class] [-f font] [-g geometry]"
+	    " [-n name]\n"
+	    "          [-T title] [-t title] [-w windowid] {-p|-P} file\n",
+	    argv0, argv0, argv0);
 }
 
 int
@@ -2118,6 +2469,15 @@ main(int argc, char *argv[])
 	case 'o':
 		opt_io = EARGF(usage());
 		break;
+	case 'p':
+		ttyreplay(EARGF(usage()), 1);
+		break;
+	case 'P':
+		ttyreplay(EARGF(usage()), 0);
+		break;
+	case 'r':
+		ttyrecord(EARGF(usage()));
+		break;
 	case 'l':
 		opt_line = EARGF(usage());
 		break;